@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <atomic>
+
+#include "bipartition.hh"
+
+// ----------------------------------------------------------------------
+
+  // http://xorshift.di.unimi.it/splitmix64.c
+static inline uint64_t splitmix64(uint64_t& aState)
+{
+    uint64_t z = (aState += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// ----------------------------------------------------------------------
+
+LeafHashes::LeafHashes(const std::vector<const Tree*>& aTrees)
+    : mAll(0)
+{
+    std::unordered_map<std::string, size_t> found; // name -> number of trees having it exactly once
+    for (const auto* tree: aTrees) {
+        std::unordered_map<std::string, size_t> in_tree;
+        iterate(static_cast<const Node&>(*tree), [&in_tree](const Node& aNode) { ++in_tree[aNode.name]; });
+        for (const auto& name_count: in_tree) {
+            if (name_count.second == 1)
+                ++found[name_count.first];
+        }
+    }
+
+    uint64_t state = 0x7265646966667472ULL; // fixed seed, hashes are the same in every run
+    for (const auto& name_count: found) {
+        if (name_count.second == aTrees.size()) {
+            uint64_t value = splitmix64(state);
+            while (value == 0)
+                value = splitmix64(state);
+            mHashes.emplace(name_count.first, value);
+            mAll ^= value;
+        }
+    }
+
+} // LeafHashes::LeafHashes
+
+// ----------------------------------------------------------------------
+
+uint64_t LeafHashes::operator[](std::string aName) const
+{
+    auto const found = mHashes.find(aName);
+    return found == mHashes.end() ? 0 : found->second;
+
+} // LeafHashes::operator[]
+
+// ----------------------------------------------------------------------
+
+  // Returns hash and number of common leaves of aNode subtree
+static std::pair<uint64_t, size_t> collect_splits(const Node& aNode, const LeafHashes& aLeaves, std::vector<Split>& aSplits)
+{
+    if (aNode.is_leaf()) {
+        auto const hash = aLeaves[aNode.name];
+        return {hash, hash ? 1 : 0};
+    }
+    uint64_t hash = 0;
+    size_t size = 0;
+    for (const auto& node: aNode.subtree) {
+        auto const child = collect_splits(node, aLeaves, aSplits);
+        hash ^= child.first;
+        size += child.second;
+    }
+    if (size >= 2 && (size + 2) <= aLeaves.size())
+        aSplits.push_back({std::min(hash, hash ^ aLeaves.all()), &aNode, size, aNode.edge_length});
+    return {hash, size};
+
+} // collect_splits
+
+std::vector<Split> tree_splits(const Node& aTree, const LeafHashes& aLeaves)
+{
+    std::vector<Split> splits;
+    collect_splits(aTree, aLeaves, splits);
+    std::sort(splits.begin(), splits.end(), [](const Split& a, const Split& b) { return a.hash < b.hash; });
+
+      // edges of unary nodes and the two edges of the root separate the same sides
+    auto last = splits.begin();
+    for (auto split = splits.begin(); split != splits.end(); ++split) {
+        if (split == splits.begin())
+            continue;
+        if (split->hash == last->hash) {
+            last->edge_length += split->edge_length;
+            if (split->size < last->size) { // keep the smaller side for reporting
+                last->node = split->node;
+                last->size = split->size;
+            }
+        }
+        else {
+            *++last = *split;
+        }
+    }
+    if (!splits.empty())
+        splits.erase(last + 1, splits.end());
+    return splits;
+
+} // tree_splits
+
+// ----------------------------------------------------------------------
+
+std::vector<std::string> split_members(const Split& aSplit, const LeafHashes& aLeaves)
+{
+    std::vector<std::string> members;
+    members.reserve(aSplit.size);
+    iterate(*aSplit.node, [&](const Node& aNode) { if (aLeaves[aNode.name]) members.push_back(aNode.name); });
+    return members;
+
+} // split_members
+
+// ----------------------------------------------------------------------
+
+size_t number_of_uncommon_leaves(const Node& aTree, const LeafHashes& aLeaves)
+{
+    size_t number = 0;
+    iterate(aTree, [&](const Node& aNode) { if (!aLeaves[aNode.name]) ++number; });
+    return number;
+
+} // number_of_uncommon_leaves
+
+// ----------------------------------------------------------------------
+
+  // Both split lists are sorted by hash, they are merged in one pass
+SplitsDiff compare_splits(const std::vector<Split>& aFirst, const std::vector<Split>& aSecond)
+{
+    SplitsDiff diff;
+    diff.weighted = 0;
+    auto first = aFirst.begin(), second = aSecond.begin();
+    while (first != aFirst.end() || second != aSecond.end()) {
+        if (second == aSecond.end() || (first != aFirst.end() && first->hash < second->hash)) {
+            diff.only_in_first.push_back(&*first);
+            diff.weighted += std::abs(first->edge_length);
+            ++first;
+        }
+        else if (first == aFirst.end() || second->hash < first->hash) {
+            diff.only_in_second.push_back(&*second);
+            diff.weighted += std::abs(second->edge_length);
+            ++second;
+        }
+        else {
+            diff.weighted += std::abs(first->edge_length - second->edge_length);
+            ++first;
+            ++second;
+        }
+    }
+    return diff;
+
+} // compare_splits
+
+// ----------------------------------------------------------------------
+
+SplitSet::SplitSet(const std::vector<Split>& aSplits)
+{
+    hashes.reserve(aSplits.size());
+    edge_lengths.reserve(aSplits.size());
+    for (const auto& split: aSplits) {
+        hashes.push_back(split.hash);
+        edge_lengths.push_back(split.edge_length);
+    }
+
+} // SplitSet::SplitSet
+
+// ----------------------------------------------------------------------
+
+SplitsDistance splits_distance(const SplitSet& aFirst, const SplitSet& aSecond)
+{
+    SplitsDistance distance{0, 0.0};
+    size_t first = 0, second = 0;
+    while (first < aFirst.hashes.size() && second < aSecond.hashes.size()) {
+        if (aFirst.hashes[first] < aSecond.hashes[second]) {
+            ++distance.robinson_foulds;
+            distance.weighted += std::abs(aFirst.edge_lengths[first++]);
+        }
+        else if (aSecond.hashes[second] < aFirst.hashes[first]) {
+            ++distance.robinson_foulds;
+            distance.weighted += std::abs(aSecond.edge_lengths[second++]);
+        }
+        else {
+            distance.weighted += std::abs(aFirst.edge_lengths[first++] - aSecond.edge_lengths[second++]);
+        }
+    }
+    distance.robinson_foulds += (aFirst.hashes.size() - first) + (aSecond.hashes.size() - second);
+    for (; first < aFirst.hashes.size(); ++first)
+        distance.weighted += std::abs(aFirst.edge_lengths[first]);
+    for (; second < aSecond.hashes.size(); ++second)
+        distance.weighted += std::abs(aSecond.edge_lengths[second]);
+    return distance;
+
+} // splits_distance
+
+// ----------------------------------------------------------------------
+
+constexpr size_t sDistanceMatrixBlock = 8; // trees per block side, splits of two blocks of large trees still fit into L2 cache
+
+  // Upper triangle is split into blocks of sDistanceMatrixBlock x
+  // sDistanceMatrixBlock pairs, threads take blocks one by one, so split
+  // sets of a block are reused from cache while the block is computed.
+DistanceMatrix::DistanceMatrix(const std::vector<SplitSet>& aSets, size_t aNumberOfThreads)
+    : mSize(aSets.size()), mDistances(aSets.size() * aSets.size(), SplitsDistance{0, 0.0})
+{
+    const size_t blocks_per_side = (mSize + sDistanceMatrixBlock - 1) / sDistanceMatrixBlock;
+    std::vector<std::pair<size_t, size_t>> blocks;
+    for (size_t block_row = 0; block_row < blocks_per_side; ++block_row) {
+        for (size_t block_column = block_row; block_column < blocks_per_side; ++block_column)
+            blocks.emplace_back(block_row * sDistanceMatrixBlock, block_column * sDistanceMatrixBlock);
+    }
+
+    std::atomic<size_t> next_block(0);
+    auto worker = [&]() {
+        for (size_t block_no = next_block++; block_no < blocks.size(); block_no = next_block++) {
+            const size_t row_end = std::min(blocks[block_no].first + sDistanceMatrixBlock, mSize), column_end = std::min(blocks[block_no].second + sDistanceMatrixBlock, mSize);
+            for (size_t row = blocks[block_no].first; row < row_end; ++row) {
+                for (size_t column = std::max(blocks[block_no].second, row + 1); column < column_end; ++column)
+                    mDistances[row * mSize + column] = mDistances[column * mSize + row] = splits_distance(aSets[row], aSets[column]);
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t thread_no = 1; thread_no < std::min(std::max(aNumberOfThreads, size_t(1)), blocks.size()); ++thread_no)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread: threads)
+        thread.join();
+
+} // DistanceMatrix::DistanceMatrix
+
+// ----------------------------------------------------------------------
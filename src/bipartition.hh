@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include "tree.hh"
+
+// ----------------------------------------------------------------------
+// Splits (bipartitions) of trees over the leaf set common to the trees
+// compared. Each common leaf gets a random 64-bit value, a split is
+// identified by XOR of the values of the leaves on one side of it, so
+// all splits of a tree are collected in one pass over the tree.
+// ----------------------------------------------------------------------
+
+class LeafHashes
+{
+ public:
+    LeafHashes(const std::vector<const Tree*>& aTrees); // leaves found exactly once in each of aTrees
+
+    inline size_t size() const { return mHashes.size(); }
+    inline uint64_t all() const { return mAll; }
+    uint64_t operator[](std::string aName) const; // 0 if aName is not a common leaf
+
+ private:
+    std::unordered_map<std::string, uint64_t> mHashes;
+    uint64_t mAll;              // XOR of all values, hash of the complement is mAll ^ hash
+
+}; // class LeafHashes
+
+// ----------------------------------------------------------------------
+
+struct Split
+{
+    uint64_t hash;              // smaller of the hashes of the two sides
+    const Node* node;           // root of the subtree on one side of the split
+    size_t size;                // number of common leaves in the subtree
+    double edge_length;         // sum of the edges separating the two sides
+};
+
+  // Non-trivial splits (both sides have at least 2 common leaves) sorted by
+  // hash, splits repeated because of unary nodes or the root are merged.
+std::vector<Split> tree_splits(const Node& aTree, const LeafHashes& aLeaves);
+
+  // Common leaves in the subtree of aSplit.node
+std::vector<std::string> split_members(const Split& aSplit, const LeafHashes& aLeaves);
+
+  // Number of leaves of aTree that are not common leaves
+size_t number_of_uncommon_leaves(const Node& aTree, const LeafHashes& aLeaves);
+
+// ----------------------------------------------------------------------
+
+struct SplitsDiff
+{
+    std::vector<const Split*> only_in_first, only_in_second;
+    double weighted;            // sum of edge length differences over all splits, absent split has zero edge
+
+    inline size_t robinson_foulds() const { return only_in_first.size() + only_in_second.size(); }
+};
+
+SplitsDiff compare_splits(const std::vector<Split>& aFirst, const std::vector<Split>& aSecond);
+
+// ----------------------------------------------------------------------
+// Pairwise distances of many trees over the leaves common to all of them
+
+struct SplitSet              // hashes and edge lengths of tree_splits() in separate arrays for faster merging
+{
+    inline SplitSet() = default;
+    SplitSet(const std::vector<Split>& aSplits);
+
+    std::vector<uint64_t> hashes; // sorted
+    std::vector<double> edge_lengths;
+};
+
+struct SplitsDistance
+{
+    size_t robinson_foulds;
+    double weighted;
+};
+
+SplitsDistance splits_distance(const SplitSet& aFirst, const SplitSet& aSecond);
+
+class DistanceMatrix
+{
+ public:
+    DistanceMatrix(const std::vector<SplitSet>& aSets, size_t aNumberOfThreads);
+
+    inline size_t size() const { return mSize; }
+    inline const SplitsDistance& operator()(size_t aRow, size_t aColumn) const { return mDistances[aRow * mSize + aColumn]; }
+
+ private:
+    size_t mSize;
+    std::vector<SplitsDistance> mDistances; // mSize x mSize, row major
+};
+
+// ----------------------------------------------------------------------
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// ----------------------------------------------------------------------
+
+// Queue between pipeline stages, producers block while it is full, so
+// a fast stage cannot run too far ahead (and use memory) of a slow one.
+template <typename T> class BoundedQueue
+{
+ public:
+    inline BoundedQueue(size_t aCapacity) : mCapacity(aCapacity), mClosed(false) {}
+
+    inline void push(T aValue)
+        {
+            std::unique_lock<std::mutex> lock(mAccess);
+            mNotFull.wait(lock, [this]() { return mQueue.size() < mCapacity; });
+            mQueue.push_back(std::move(aValue));
+            mNotEmpty.notify_one();
+        }
+
+      // returns false if queue is closed and empty
+    inline bool pop(T& aValue)
+        {
+            std::unique_lock<std::mutex> lock(mAccess);
+            mNotEmpty.wait(lock, [this]() { return !mQueue.empty() || mClosed; });
+            if (mQueue.empty())
+                return false;
+            aValue = std::move(mQueue.front());
+            mQueue.pop_front();
+            mNotFull.notify_one();
+            return true;
+        }
+
+      // no more values will be pushed
+    inline void close()
+        {
+            std::unique_lock<std::mutex> lock(mAccess);
+            mClosed = true;
+            mNotEmpty.notify_all();
+        }
+
+ private:
+    size_t mCapacity;
+    bool mClosed;
+    std::deque<T> mQueue;
+    std::mutex mAccess;
+    std::condition_variable mNotFull, mNotEmpty;
+
+}; // class BoundedQueue
+
+// ----------------------------------------------------------------------
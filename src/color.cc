@@ -57,12 +57,10 @@ const size_t sDistinctColors[] = {
 
 // ----------------------------------------------------------------------
 
-static Colors* sColors = nullptr;
-
+  // initialization of function local static is thread safe, the object is never destroyed
 Colors& colors()
 {
-    if (sColors == nullptr)
-        sColors = new Colors();
+    static Colors* const sColors = new Colors();
     return *sColors;
 
 } // colors
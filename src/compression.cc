@@ -0,0 +1,76 @@
+#include <vector>
+
+#include "compression.hh"
+#include "xz.hh"
+#include "gzip.hh"
+#include "zstd.hh"
+
+// ----------------------------------------------------------------------
+
+template <typename D> static std::unique_ptr<Decompressor> make_decompressor()
+{
+    return std::unique_ptr<Decompressor>(new D());
+}
+
+#pragma GCC diagnostic push
+#ifdef __clang__
+#pragma GCC diagnostic ignored "-Wglobal-constructors"
+#pragma GCC diagnostic ignored "-Wexit-time-destructors"
+#endif
+
+static const std::vector<Codec> sCodecs = {
+    {"xz", ".xz", std::string(XZ_SIGNATURE, XZ_SIGNATURE_SIZE), &xz_compress, &xz_decompress, &make_decompressor<XzDecompressor>},
+    {"gzip", ".gz", std::string(GZIP_SIGNATURE, GZIP_SIGNATURE_SIZE), &gzip_compress, &gzip_decompress, &make_decompressor<GzipDecompressor>},
+#ifdef HAVE_ZSTD
+    {"zstd", ".zst", std::string(ZSTD_SIGNATURE, ZSTD_SIGNATURE_SIZE), &zstd_compress, &zstd_decompress, &make_decompressor<ZstdDecompressor>},
+#endif
+};
+
+#pragma GCC diagnostic pop
+
+// ----------------------------------------------------------------------
+
+const Codec* codec_for_data(const std::string& aData)
+{
+    for (const auto& codec: sCodecs) {
+        if (aData.compare(0, codec.magic.size(), codec.magic) == 0)
+            return &codec;
+    }
+    return nullptr;
+
+} // codec_for_data
+
+// ----------------------------------------------------------------------
+
+const Codec* codec_for_filename(std::string aFilename)
+{
+    for (const auto& codec: sCodecs) {
+        const std::string suffix = codec.suffix;
+        if (aFilename.size() > suffix.size() && aFilename.compare(aFilename.size() - suffix.size(), suffix.size(), suffix) == 0)
+            return &codec;
+    }
+    return nullptr;
+
+} // codec_for_filename
+
+// ----------------------------------------------------------------------
+
+size_t codec_magic_size()
+{
+    size_t size = 0;
+    for (const auto& codec: sCodecs)
+        size = std::max(size, codec.magic.size());
+    return size;
+
+} // codec_magic_size
+
+// ----------------------------------------------------------------------
+
+std::string decompress_if_compressed(std::string aData)
+{
+    auto const codec = codec_for_data(aData);
+    return codec != nullptr ? codec->decompress(aData) : aData;
+
+} // decompress_if_compressed
+
+// ----------------------------------------------------------------------
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+// ----------------------------------------------------------------------
+
+// Incremental decoder, input can be fed in chunks as they arrive (e.g. from a pipe)
+class Decompressor
+{
+ public:
+    virtual ~Decompressor() = default;
+    virtual void feed(const char* aData, size_t aSize) = 0;
+    virtual std::string finish() = 0; // returns decompressed data
+};
+
+// ----------------------------------------------------------------------
+
+struct Codec
+{
+    const char* name;
+    const char* suffix;         // output file suffix selecting this codec
+    std::string magic;          // signature at the beginning of compressed data
+    std::string (*compress)(std::string input);
+    std::string (*decompress)(std::string input);
+    std::unique_ptr<Decompressor> (*decompressor)();
+};
+
+  // nullptr if data is not compressed by any registered codec
+const Codec* codec_for_data(const std::string& aData);
+  // nullptr if suffix of aFilename does not match any registered codec
+const Codec* codec_for_filename(std::string aFilename);
+  // number of leading bytes needed to detect codec
+size_t codec_magic_size();
+
+std::string decompress_if_compressed(std::string aData);
+
+// ----------------------------------------------------------------------
@@ -0,0 +1,123 @@
+#include <stdexcept>
+
+#include "gzip.hh"
+
+#pragma GCC diagnostic push
+#ifdef __clang__
+#pragma GCC diagnostic ignored "-Wdocumentation"
+#pragma GCC diagnostic ignored "-Wdocumentation-unknown-command"
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wzero-as-null-pointer-constant"
+#endif
+#include <zlib.h>
+#pragma GCC diagnostic pop
+
+// ----------------------------------------------------------------------
+
+constexpr size_t sGzipBufSize = 409600;
+constexpr int sGzipWindowBits = 15 + 16; // +16: gzip header instead of zlib one
+constexpr int sGzipLevel = 9;
+
+// ----------------------------------------------------------------------
+
+std::string gzip_compress(std::string input)
+{
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    if (deflateInit2(&strm, sGzipLevel, Z_DEFLATED, sGzipWindowBits, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("gzip compression failed 1");
+    }
+
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.c_str()));
+    strm.avail_in = static_cast<uInt>(input.size());
+    std::string output(deflateBound(&strm, static_cast<uLong>(input.size())), ' ');
+    strm.next_out = reinterpret_cast<Bytef*>(&*output.begin());
+    strm.avail_out = static_cast<uInt>(output.size());
+    auto const r = deflate(&strm, Z_FINISH); // output is large enough for a single call
+    if (r != Z_STREAM_END) {
+        deflateEnd(&strm);
+        throw std::runtime_error("gzip compression failed 2");
+    }
+    output.resize(strm.total_out);
+    deflateEnd(&strm);
+    return output;
+
+} // gzip_compress
+
+// ----------------------------------------------------------------------
+
+std::string gzip_decompress(std::string input)
+{
+    GzipDecompressor decompressor;
+    decompressor.feed(input.c_str(), input.size());
+    return decompressor.finish();
+
+} // gzip_decompress
+
+// ----------------------------------------------------------------------
+
+struct GzipDecompressor::Stream
+{
+    z_stream strm;
+    bool stream_end = false;
+};
+
+GzipDecompressor::GzipDecompressor()
+    : mStream(new Stream), mOutput(sGzipBufSize, ' '), mOffset(0)
+{
+    z_stream& strm = mStream->strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.next_in = Z_NULL;
+    strm.avail_in = 0;
+    if (inflateInit2(&strm, sGzipWindowBits) != Z_OK) {
+        throw std::runtime_error("gzip decompression failed 1");
+    }
+}
+
+GzipDecompressor::~GzipDecompressor()
+{
+    inflateEnd(&mStream->strm);
+}
+
+// ----------------------------------------------------------------------
+
+void GzipDecompressor::feed(const char* aData, size_t aSize)
+{
+    z_stream& strm = mStream->strm;
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(aData));
+    strm.avail_in = static_cast<uInt>(aSize);
+    while (strm.avail_in > 0) {
+        if (mStream->stream_end) { // concatenated gzip members (e.g. produced by pigz or cat a.gz b.gz)
+            inflateReset(&strm);
+            mStream->stream_end = false;
+        }
+        if ((mOutput.size() - mOffset) < sGzipBufSize)
+            mOutput.resize(mOutput.size() * 2);
+        strm.next_out = reinterpret_cast<Bytef*>(&*(mOutput.begin() + static_cast<ssize_t>(mOffset)));
+        strm.avail_out = static_cast<uInt>(mOutput.size() - mOffset);
+        auto const r = inflate(&strm, Z_NO_FLUSH);
+        mOffset = mOutput.size() - strm.avail_out;
+        if (r == Z_STREAM_END)
+            mStream->stream_end = true;
+        else if (r != Z_OK && r != Z_BUF_ERROR)
+            throw std::runtime_error("gzip decompression failed 2");
+    }
+
+} // GzipDecompressor::feed
+
+// ----------------------------------------------------------------------
+
+std::string GzipDecompressor::finish()
+{
+    if (!mStream->stream_end)
+        throw std::runtime_error("gzip decompression failed: unexpected end of input");
+    mOutput.resize(mOffset);
+    return std::move(mOutput);
+
+} // GzipDecompressor::finish
+
+// ----------------------------------------------------------------------
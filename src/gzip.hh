@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+#include "compression.hh"
+
+// ----------------------------------------------------------------------
+
+constexpr size_t GZIP_SIGNATURE_SIZE = 2;
+constexpr char GZIP_SIGNATURE[GZIP_SIGNATURE_SIZE] = { '\x1F', '\x8B' };
+
+std::string gzip_compress(std::string input);
+std::string gzip_decompress(std::string input);
+
+// ----------------------------------------------------------------------
+
+class GzipDecompressor : public Decompressor
+{
+ public:
+    GzipDecompressor();
+    virtual ~GzipDecompressor();
+
+    virtual void feed(const char* aData, size_t aSize);
+    virtual std::string finish();
+
+ private:
+    struct Stream;
+    std::unique_ptr<Stream> mStream;
+    std::string mOutput;
+    size_t mOffset;
+
+}; // class GzipDecompressor
+
+// ----------------------------------------------------------------------
@@ -0,0 +1,119 @@
+#include <stdexcept>
+
+#include "lca-index.hh"
+#include "tree.hh"
+#include "parallel-for.hh"
+
+// ----------------------------------------------------------------------
+
+LcaIndex::LcaIndex(const Tree& aTree)
+{
+    tour(aTree, 0, 0.0);
+
+    mSparse.push_back(std::vector<uint32_t>(mTour.size()));
+    for (uint32_t pos = 0; pos < mTour.size(); ++pos)
+        mSparse[0][pos] = pos;
+    for (size_t width = 2; width <= mTour.size(); width *= 2) {
+        const auto& previous = mSparse.back();
+        std::vector<uint32_t> level(mTour.size() - width + 1);
+        for (size_t pos = 0; pos < level.size(); ++pos)
+            level[pos] = shallower(previous[pos], previous[pos + width / 2]);
+        mSparse.push_back(std::move(level));
+    }
+
+} // LcaIndex::LcaIndex
+
+// ----------------------------------------------------------------------
+
+void LcaIndex::tour(const Node& aNode, uint32_t aLevel, double aEdgeDepth)
+{
+    const auto node_index = static_cast<uint32_t>(mNodes.size());
+    mNodes.push_back(&aNode);
+    mNodeIndex.emplace(&aNode, node_index);
+    mEdgeDepth.push_back(aEdgeDepth);
+    mLevel.push_back(aLevel);
+    mFirst.push_back(static_cast<uint32_t>(mTour.size()));
+    mTour.push_back(node_index);
+    for (const auto& node: aNode.subtree) {
+        tour(node, aLevel + 1, aEdgeDepth + node.edge_length);
+        mTour.push_back(node_index);
+    }
+
+} // LcaIndex::tour
+
+// ----------------------------------------------------------------------
+
+uint32_t LcaIndex::index(const Node* aNode) const
+{
+    auto const found = mNodeIndex.find(aNode);
+    if (found == mNodeIndex.end())
+        throw std::runtime_error("LcaIndex: node is not in the tree");
+    return found->second;
+
+} // LcaIndex::index
+
+// ----------------------------------------------------------------------
+
+uint32_t LcaIndex::lca_index(uint32_t aFirst, uint32_t aSecond) const
+{
+    uint32_t begin = mFirst[aFirst], end = mFirst[aSecond];
+    if (begin > end)
+        std::swap(begin, end);
+    const auto level = static_cast<size_t>(31 - __builtin_clz(end - begin + 1)); // floor(log2(range length))
+    return mTour[shallower(mSparse[level][begin], mSparse[level][end + 1 - (size_t(1) << level)])];
+
+} // LcaIndex::lca_index
+
+// ----------------------------------------------------------------------
+
+const Node* LcaIndex::lca(const Node* aFirst, const Node* aSecond) const
+{
+    return mNodes[lca_index(index(aFirst), index(aSecond))];
+
+} // LcaIndex::lca
+
+// ----------------------------------------------------------------------
+
+double LcaIndex::distance(const Node* aFirst, const Node* aSecond) const
+{
+    const auto first = index(aFirst), second = index(aSecond);
+    return mEdgeDepth[first] + mEdgeDepth[second] - 2.0 * mEdgeDepth[lca_index(first, second)];
+
+} // LcaIndex::distance
+
+// ----------------------------------------------------------------------
+
+  // MRCA of a set is LCA of its members visited first and last in the tour
+const Node* LcaIndex::mrca(const std::vector<const Node*>& aNodes) const
+{
+    if (aNodes.empty())
+        return nullptr;
+    uint32_t first = index(aNodes.front()), last = first;
+    for (const auto* node: aNodes) {
+        const auto node_index = index(node);
+        if (mFirst[node_index] < mFirst[first])
+            first = node_index;
+        if (mFirst[node_index] > mFirst[last])
+            last = node_index;
+    }
+    return mNodes[lca_index(first, last)];
+
+} // LcaIndex::mrca
+
+// ----------------------------------------------------------------------
+
+std::vector<double> LcaIndex::distances(const std::vector<const Node*>& aLeaves, size_t aNumberOfThreads) const
+{
+    std::vector<uint32_t> indices(aLeaves.size());
+    for (size_t leaf_no = 0; leaf_no < aLeaves.size(); ++leaf_no)
+        indices[leaf_no] = index(aLeaves[leaf_no]);
+    std::vector<double> result(aLeaves.size() * aLeaves.size(), 0.0);
+    parallel_for(aLeaves.size(), aNumberOfThreads, [&](size_t aRow) {
+            for (size_t column = 0; column < indices.size(); ++column)
+                result[aRow * indices.size() + column] = mEdgeDepth[indices[aRow]] + mEdgeDepth[indices[column]] - 2.0 * mEdgeDepth[lca_index(indices[aRow], indices[column])];
+        });
+    return result;
+
+} // LcaIndex::distances
+
+// ----------------------------------------------------------------------
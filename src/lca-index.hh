@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// ----------------------------------------------------------------------
+
+class Node;
+class Tree;
+
+// ----------------------------------------------------------------------
+// Lowest common ancestor queries in O(1) after O(n log n) preparation:
+// Euler tour of the tree and sparse table of minimum node depths over
+// its ranges. Patristic distance is computed from cumulative edge
+// lengths from the root.
+// ----------------------------------------------------------------------
+
+class LcaIndex
+{
+ public:
+    LcaIndex(const Tree& aTree);
+
+    const Node* lca(const Node* aFirst, const Node* aSecond) const;
+    double distance(const Node* aFirst, const Node* aSecond) const; // sum of edge lengths on the path between nodes
+    const Node* mrca(const std::vector<const Node*>& aNodes) const;  // nullptr if aNodes is empty
+
+      // aLeaves.size() x aLeaves.size() distances, row major, rows are computed in parallel
+    std::vector<double> distances(const std::vector<const Node*>& aLeaves, size_t aNumberOfThreads) const;
+
+ private:
+    std::vector<const Node*> mNodes;            // in preorder
+    std::unordered_map<const Node*, uint32_t> mNodeIndex;
+    std::vector<double> mEdgeDepth;             // cumulative edge length from the root, by node index
+    std::vector<uint32_t> mFirst;               // first position of node in mTour, by node index
+    std::vector<uint32_t> mTour;                // node indices in the Euler tour order
+    std::vector<uint32_t> mLevel;               // number of edges from the root, by node index
+    std::vector<std::vector<uint32_t>> mSparse; // mSparse[k][i] - position of the shallowest node in mTour[i .. i + 2^k - 1]
+
+    void tour(const Node& aNode, uint32_t aLevel, double aEdgeDepth);
+    uint32_t index(const Node* aNode) const;
+    inline uint32_t shallower(uint32_t aPos1, uint32_t aPos2) const { return mLevel[mTour[aPos1]] <= mLevel[mTour[aPos2]] ? aPos1 : aPos2; }
+    uint32_t lca_index(uint32_t aFirst, uint32_t aSecond) const;
+};
+
+// ----------------------------------------------------------------------
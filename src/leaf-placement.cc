@@ -0,0 +1,143 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include "leaf-placement.hh"
+#include "tree.hh"
+
+// ----------------------------------------------------------------------
+
+struct LeafPlacement
+{
+    const Node* leaf;
+    const std::string* branch_id; // of the nearest enclosing subtree having it
+
+    inline json to_json() const { return {{"branch_id", *branch_id}, {"clades", leaf->clades}}; }
+    inline bool operator==(const LeafPlacement& a) const { return *branch_id == *a.branch_id && leaf->clades == a.leaf->clades; }
+};
+
+class LeafPlacements
+{
+ public:
+    LeafPlacements(const Tree& aTree);
+
+    inline const std::vector<LeafPlacement>& in_line_order() const { return mLeaves; }
+    inline const LeafPlacement* find(std::string aName) const { auto const found = mByName.find(aName); return found == mByName.end() ? nullptr : &mLeaves[found->second]; }
+
+ private:
+    std::vector<LeafPlacement> mLeaves;
+    std::unordered_map<std::string, size_t> mByName; // name -> index in mLeaves, the first one if name is repeated
+
+    void collect(const Node& aNode, const std::string* aBranchId);
+};
+
+static std::vector<size_t> longest_increasing_subsequence(const std::vector<size_t>& aSequence);
+static json leaf_to_json(const LeafPlacement& aLeaf);
+
+// ----------------------------------------------------------------------
+
+json leaf_placement_diff(const Tree& aOld, const Tree& aNew)
+{
+    const LeafPlacements old_leaves(aOld), new_leaves(aNew);
+    json removed = json::array(), added = json::array(), moved = json::array(), displaced = json::array();
+
+    std::vector<const LeafPlacement*> shared_old, shared_new; // in the old line order
+    for (const auto& leaf: old_leaves.in_line_order()) {
+        const auto* new_leaf = new_leaves.find(leaf.leaf->name);
+        if (new_leaf == nullptr) {
+            removed.push_back(leaf_to_json(leaf));
+        }
+        else if (old_leaves.find(leaf.leaf->name) == &leaf) {
+            shared_old.push_back(&leaf);
+            shared_new.push_back(new_leaf);
+            if (!(leaf == *new_leaf))
+                moved.push_back({{"name", leaf.leaf->name}, {"old", leaf.to_json()}, {"new", new_leaf->to_json()}});
+        }
+    }
+    for (const auto& leaf: new_leaves.in_line_order()) {
+        if (old_leaves.find(leaf.leaf->name) == nullptr)
+            added.push_back(leaf_to_json(leaf));
+    }
+
+    std::vector<size_t> new_lines(shared_new.size());
+    std::transform(shared_new.begin(), shared_new.end(), new_lines.begin(), [](const LeafPlacement* a) { return a->leaf->line_no; });
+    const auto in_order = longest_increasing_subsequence(new_lines);
+    auto kept = in_order.begin();
+    for (size_t index = 0; index < shared_old.size(); ++index) {
+        if (kept != in_order.end() && *kept == index)
+            ++kept;
+        else
+            displaced.push_back({{"name", shared_old[index]->leaf->name}, {"old_line", shared_old[index]->leaf->line_no}, {"new_line", new_lines[index]}});
+    }
+
+    const json summary = {{"shared", shared_old.size()}, {"added", added.size()}, {"removed", removed.size()}, {"moved", moved.size()}, {"displaced", displaced.size()}};
+    return {{"summary", summary}, {"added", added}, {"removed", removed}, {"moved", moved}, {"displaced", displaced}};
+
+} // leaf_placement_diff
+
+// ----------------------------------------------------------------------
+
+LeafPlacements::LeafPlacements(const Tree& aTree)
+{
+    static const std::string no_branch_id;
+    collect(aTree, &no_branch_id);
+    mByName.reserve(mLeaves.size());
+    for (size_t index = 0; index < mLeaves.size(); ++index)
+        mByName.emplace(mLeaves[index].leaf->name, index);
+
+} // LeafPlacements::LeafPlacements
+
+// ----------------------------------------------------------------------
+
+void LeafPlacements::collect(const Node& aNode, const std::string* aBranchId)
+{
+    if (aNode.is_leaf()) {
+        mLeaves.push_back({&aNode, aBranchId});
+    }
+    else {
+        const std::string* branch_id = aNode.branch_id.empty() ? aBranchId : &aNode.branch_id;
+        for (const auto& node: aNode.subtree)
+            collect(node, branch_id);
+    }
+
+} // LeafPlacements::collect
+
+// ----------------------------------------------------------------------
+
+static json leaf_to_json(const LeafPlacement& aLeaf)
+{
+    return {{"name", aLeaf.leaf->name}, {"line", aLeaf.leaf->line_no}, {"branch_id", *aLeaf.branch_id}, {"clades", aLeaf.leaf->clades}};
+
+} // leaf_to_json
+
+// ----------------------------------------------------------------------
+
+  // Returns indices (ascending) of the elements of one of the longest
+  // strictly increasing subsequences of aSequence, O(n log n).
+static std::vector<size_t> longest_increasing_subsequence(const std::vector<size_t>& aSequence)
+{
+    std::vector<size_t> tails;  // tails[k] - index of the smallest last element of increasing subsequences of length k+1
+    std::vector<size_t> previous(aSequence.size()); // index of the preceding element in the subsequence
+    for (size_t index = 0; index < aSequence.size(); ++index) {
+        auto const position = std::lower_bound(tails.begin(), tails.end(), aSequence[index], [&aSequence](size_t aTail, size_t aValue) { return aSequence[aTail] < aValue; });
+        previous[index] = position == tails.begin() ? index : *(position - 1);
+        if (position == tails.end())
+            tails.push_back(index);
+        else
+            *position = index;
+    }
+
+    std::vector<size_t> result(tails.size());
+    if (!tails.empty()) {
+        size_t index = tails.back();
+        for (auto element = result.rbegin(); element != result.rend(); ++element) {
+            *element = index;
+            index = previous[index];
+        }
+    }
+    return result;
+
+} // longest_increasing_subsequence
+
+// ----------------------------------------------------------------------
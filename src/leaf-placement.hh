@@ -0,0 +1,22 @@
+#pragma once
+
+#include "json.hh"
+
+// ----------------------------------------------------------------------
+
+class Tree;
+
+  // Compares leaf placement in two versions of a tree (both must be
+  // analysed). Returns
+  //   {"summary": {"shared": N, "added": N, "removed": N, "moved": N, "displaced": N},
+  //    "added": [{"name", "line", "branch_id", "clades"}],     <- in aNew only
+  //    "removed": [{"name", "line", "branch_id", "clades"}],   <- in aOld only
+  //    "moved": [{"name", "old": {"branch_id", "clades"}, "new": {"branch_id", "clades"}}],
+  //    "displaced": [{"name", "old_line", "new_line"}]}
+  // branch_id is the one of the nearest enclosing subtree having it. A
+  // leaf is moved if its branch_id or clades changed. Displaced leaves are
+  // shared leaves outside of the longest subsequence keeping their
+  // relative line order.
+json leaf_placement_diff(const Tree& aOld, const Tree& aNew);
+
+// ----------------------------------------------------------------------
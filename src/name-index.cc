@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <iterator>
+#include <cctype>
+
+#include "name-index.hh"
+#include "tree.hh"
+
+// ----------------------------------------------------------------------
+
+static inline std::string upper(std::string aSource)
+{
+    std::transform(aSource.begin(), aSource.end(), aSource.begin(), [](char c) { return static_cast<char>(std::toupper(static_cast<unsigned char>(c))); });
+    return aSource;
+}
+
+static inline uint32_t trigram(const std::string& aSource, size_t aPos)
+{
+    return (static_cast<uint32_t>(static_cast<unsigned char>(aSource[aPos])) << 16) | (static_cast<uint32_t>(static_cast<unsigned char>(aSource[aPos + 1])) << 8) | static_cast<uint32_t>(static_cast<unsigned char>(aSource[aPos + 2]));
+}
+
+// ----------------------------------------------------------------------
+
+NameIndex::NameIndex(const Tree& aTree)
+{
+    collect(aTree, nullptr);
+
+    mUpperNames.reserve(mLeaves.size());
+    mSorted.reserve(mLeaves.size());
+    for (uint32_t index = 0; index < mLeaves.size(); ++index) {
+        mExact[mLeaves[index]->name].push_back(index);
+        mUpperNames.push_back(upper(mLeaves[index]->name));
+        mSorted.push_back(index);
+        const auto& name = mUpperNames.back();
+        for (size_t pos = 0; (pos + 3) <= name.size(); ++pos) {
+            auto& postings = mTrigrams[trigram(name, pos)];
+            if (postings.empty() || postings.back() != index) // trigram repeated in the name
+                postings.push_back(index);
+        }
+    }
+    std::sort(mSorted.begin(), mSorted.end(), [this](uint32_t a, uint32_t b) { return mUpperNames[a] < mUpperNames[b]; });
+
+} // NameIndex::NameIndex
+
+// ----------------------------------------------------------------------
+
+void NameIndex::collect(const Node& aNode, const Node* aParent)
+{
+    if (aParent != nullptr)
+        mParent.emplace(&aNode, aParent);
+    if (aNode.is_leaf()) {
+        mLeaves.push_back(&aNode);
+    }
+    else {
+        for (const auto& node: aNode.subtree)
+            collect(node, &aNode);
+    }
+
+} // NameIndex::collect
+
+// ----------------------------------------------------------------------
+
+std::vector<const Node*> NameIndex::exact(std::string aName) const
+{
+    auto const found = mExact.find(aName);
+    return found == mExact.end() ? std::vector<const Node*>() : to_nodes(found->second);
+
+} // NameIndex::exact
+
+// ----------------------------------------------------------------------
+
+std::vector<const Node*> NameIndex::prefix(std::string aPrefix) const
+{
+    aPrefix = upper(aPrefix);
+    std::vector<uint32_t> indices;
+    auto first = std::lower_bound(mSorted.begin(), mSorted.end(), aPrefix, [this](uint32_t aIndex, const std::string& aValue) { return mUpperNames[aIndex] < aValue; });
+    for (; first != mSorted.end() && mUpperNames[*first].compare(0, aPrefix.size(), aPrefix) == 0; ++first)
+        indices.push_back(*first);
+    std::sort(indices.begin(), indices.end());
+    return to_nodes(indices);
+
+} // NameIndex::prefix
+
+// ----------------------------------------------------------------------
+
+  // Candidates are names having all trigrams of aText (intersection of
+  // posting lists, the shortest first), then checked for the substring.
+std::vector<const Node*> NameIndex::substring(std::string aText) const
+{
+    aText = upper(aText);
+    std::vector<uint32_t> indices;
+    if (aText.size() < 3) {
+        for (uint32_t index = 0; index < mUpperNames.size(); ++index) {
+            if (mUpperNames[index].find(aText) != std::string::npos)
+                indices.push_back(index);
+        }
+        return to_nodes(indices);
+    }
+
+    std::vector<const std::vector<uint32_t>*> postings;
+    for (size_t pos = 0; (pos + 3) <= aText.size(); ++pos) {
+        auto const found = mTrigrams.find(trigram(aText, pos));
+        if (found == mTrigrams.end())
+            return {};
+        postings.push_back(&found->second);
+    }
+    std::sort(postings.begin(), postings.end(), [](const std::vector<uint32_t>* a, const std::vector<uint32_t>* b) { return a->size() < b->size(); });
+
+    indices = *postings.front();
+    for (auto posting = postings.begin() + 1; posting != postings.end() && !indices.empty(); ++posting) {
+        std::vector<uint32_t> common;
+        std::set_intersection(indices.begin(), indices.end(), (*posting)->begin(), (*posting)->end(), std::back_inserter(common));
+        indices.swap(common);
+    }
+    indices.erase(std::remove_if(indices.begin(), indices.end(), [&](uint32_t aIndex) { return mUpperNames[aIndex].find(aText) == std::string::npos; }), indices.end());
+    return to_nodes(indices);
+
+} // NameIndex::substring
+
+// ----------------------------------------------------------------------
+
+std::vector<const Node*> NameIndex::find(std::string aQuery) const
+{
+    if (aQuery.size() >= 2 && aQuery.front() == '*' && aQuery.back() == '*')
+        return substring(aQuery.substr(1, aQuery.size() - 2));
+    else if (!aQuery.empty() && aQuery.back() == '*')
+        return prefix(aQuery.substr(0, aQuery.size() - 1));
+    else
+        return exact(aQuery);
+
+} // NameIndex::find
+
+// ----------------------------------------------------------------------
+
+std::vector<std::string> NameIndex::root_path(const Node* aNode) const
+{
+    std::vector<std::string> path;
+    for (auto parent = mParent.find(aNode); parent != mParent.end(); parent = mParent.find(parent->second)) {
+        if (!parent->second->branch_id.empty())
+            path.push_back(parent->second->branch_id);
+    }
+    std::reverse(path.begin(), path.end());
+    return path;
+
+} // NameIndex::root_path
+
+// ----------------------------------------------------------------------
+
+std::vector<const Node*> NameIndex::to_nodes(const std::vector<uint32_t>& aIndices) const
+{
+    std::vector<const Node*> nodes(aIndices.size());
+    std::transform(aIndices.begin(), aIndices.end(), nodes.begin(), [this](uint32_t aIndex) { return mLeaves[aIndex]; });
+    return nodes;
+
+} // NameIndex::to_nodes
+
+// ----------------------------------------------------------------------
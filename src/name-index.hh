@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// ----------------------------------------------------------------------
+
+class Node;
+class Tree;
+
+// ----------------------------------------------------------------------
+// Leaf lookup by name built once per tree: exact names in a hash map,
+// prefixes in the sorted list of names, substrings via the index of
+// trigrams (3 character substrings) of names. Prefix and substring
+// lookups ignore case. Results are in line order.
+// ----------------------------------------------------------------------
+
+class NameIndex
+{
+ public:
+    NameIndex(const Tree& aTree);
+
+    std::vector<const Node*> exact(std::string aName) const;
+    std::vector<const Node*> prefix(std::string aPrefix) const;
+    std::vector<const Node*> substring(std::string aText) const;
+    std::vector<const Node*> find(std::string aQuery) const; // "name" - exact, "prefix*", "*text*"
+
+      // branch_id of the subtrees from the root down to the parent of aNode, subtrees without branch_id are skipped
+    std::vector<std::string> root_path(const Node* aNode) const;
+
+    inline size_t size() const { return mLeaves.size(); }
+
+ private:
+    std::vector<const Node*> mLeaves;            // in line order
+    std::vector<std::string> mUpperNames;        // names of mLeaves in upper case
+    std::unordered_map<std::string, std::vector<uint32_t>> mExact; // name -> indices in mLeaves
+    std::vector<uint32_t> mSorted;               // indices in mLeaves sorted by mUpperNames
+    std::unordered_map<uint32_t, std::vector<uint32_t>> mTrigrams; // trigram -> ascending indices in mLeaves
+    std::unordered_map<const Node*, const Node*> mParent;
+
+    void collect(const Node& aNode, const Node* aParent);
+    std::vector<const Node*> to_nodes(const std::vector<uint32_t>& aIndices) const;
+};
+
+// ----------------------------------------------------------------------
@@ -16,6 +16,8 @@ int main(int argc, const char *argv[])
     auto cl = command_line_arguments::make_command_line_arguments
             (
                 Arg<bool>('p', false, Help("print tree")),
+                Arg<std::string>("subtree", std::string(), Help("Output only the subtree with this branch_id")),
+                Arg<std::string>("keep", std::string(), Help("Remove leaves not listed in this file (one name per line)")),
                 Arg<command_line_arguments::PrintHelp>('h', "help", "Reads tree from newick formatted file and outputs its representation into json for furhter processing.\nUsage: {progname} [options] <source.tre> <output.json>\nUse - for input and/or output files to use stdin/stdout.", Help("print this help screen"))
              );
     cl->min_max(2, 2);                  // two arguments expected
@@ -35,6 +37,10 @@ int main(int argc, const char *argv[])
         Tree tre;
         TreeImage tree_image;
         import_tree(tre, cl->arg(0), tree_image);
+        if (!cl->get<std::string>("subtree").empty())
+            tre.extract_subtree(cl->get<std::string>("subtree"));
+        if (!cl->get<std::string>("keep").empty())
+            tre.prune(read_source_list(cl->get<std::string>("keep")));
         if (cl->get<bool>('p'))
             tre.print(std::cout);
         tree_to_json(tre, cl->arg(1), "newick2json", tree_image);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+#include <algorithm>
+
+// ----------------------------------------------------------------------
+
+  // Calls aWork(index) for indices 0..aSize-1 in aNumberOfThreads threads,
+  // throws the first error after all threads finished.
+template <typename F> inline void parallel_for(size_t aSize, size_t aNumberOfThreads, F aWork)
+{
+    std::vector<std::string> errors(aSize);
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t index = next++; index < aSize; index = next++) {
+            try {
+                aWork(index);
+            }
+            catch (std::exception& err) {
+                errors[index] = err.what();
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t thread_no = 1; thread_no < std::min(aNumberOfThreads, aSize); ++thread_no)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread: threads)
+        thread.join();
+    for (const auto& error: errors) {
+        if (!error.empty())
+            throw std::runtime_error(error);
+    }
+}
+
+// ----------------------------------------------------------------------
@@ -6,6 +6,9 @@
 #include <cerrno>
 #include <cstring>
 #include <stdexcept>
+#include <string>
+#include <memory>
+#include <algorithm>
 
 // ----------------------------------------------------------------------
 
@@ -36,21 +39,55 @@ inline bool file_exists(std::string aFilename)
 
 // ----------------------------------------------------------------------
 
-inline std::string read_from_file_descriptor(int fd, size_t chunk_size = 1024)
+constexpr size_t sReadChunkInitial = 64 * 1024;
+constexpr size_t sReadChunkMax = 4 * 1024 * 1024;
+constexpr int sPipeBufferSize = 1024 * 1024;
+
+// Reads from fd until EOF and passes every chunk to aConsumer(const char* data, size_t size) as soon as it arrives,
+// so that the caller can start decompressing before the writer end of the pipe is closed.
+// Chunk size grows geometrically while reads keep filling the chunk.
+template <typename Consumer> inline void read_from_file_descriptor(int fd, Consumer aConsumer)
 {
-    std::string buffer;
-    std::string::size_type offset = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+#ifdef F_SETPIPE_SZ
+          // larger pipe buffer lets writer run ahead, failure is not fatal (e.g. /proc/sys/fs/pipe-max-size is lower)
+        fcntl(fd, F_SETPIPE_SZ, sPipeBufferSize);
+#endif
+    }
+
+    size_t chunk_size = sReadChunkInitial;
+    std::unique_ptr<char[]> chunk(new char[sReadChunkMax]);
     for (;;) {
-        buffer.resize(buffer.size() + chunk_size, ' ');
-        const auto bytes_read = read(fd, (&*buffer.begin()) + offset, chunk_size);
-        if (bytes_read < 0)
+        const auto bytes_read = read(fd, chunk.get(), chunk_size);
+        if (bytes_read < 0) {
+            if (errno == EINTR)
+                continue;
             throw std::runtime_error(std::string("Cannot read from file descriptor: ") + strerror(errno));
-        if (static_cast<size_t>(bytes_read) < chunk_size) {
-            buffer.resize(buffer.size() - chunk_size + static_cast<size_t>(bytes_read));
-            break;
         }
-        offset += static_cast<size_t>(bytes_read);
+        if (bytes_read == 0)    // short read from a pipe is not EOF, only 0 is
+            break;
+        aConsumer(chunk.get(), static_cast<size_t>(bytes_read));
+        if (static_cast<size_t>(bytes_read) == chunk_size && chunk_size < sReadChunkMax)
+            chunk_size *= 2;
     }
+}
+
+// ----------------------------------------------------------------------
+
+inline std::string read_from_file_descriptor(int fd)
+{
+    std::string buffer;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        buffer.reserve(static_cast<std::string::size_type>(st.st_size));
+    else
+        buffer.reserve(sReadChunkInitial);
+    read_from_file_descriptor(fd, [&buffer](const char* aData, size_t aSize) {
+            if ((buffer.capacity() - buffer.size()) < aSize)
+                buffer.reserve(std::max(buffer.capacity() * 2, buffer.size() + aSize));
+            buffer.append(aData, aSize);
+        });
     return buffer;
 }
 
@@ -0,0 +1,67 @@
+#include <iostream>
+#include <memory>
+
+#include "render.hh"
+#include "tree.hh"
+#include "tree-image.hh"
+
+// ----------------------------------------------------------------------
+
+json render_request(const Tree& aTree, const json& aSettings, const json& aRequest)
+{
+    auto const start = std::chrono::steady_clock::now();
+    if (!aRequest.count("output"))
+        throw std::runtime_error("\"output\" is not in the request");
+    const std::string output = aRequest["output"];
+
+    json settings = aSettings;
+    if (aRequest.count("settings"))
+        merge_settings(settings, aRequest["settings"]);
+    TreeImage tree_image;
+    tree_image.load_from_json(settings);
+    tree_image.clades().show(aRequest.count("clades") && aRequest["clades"].get<bool>());
+    std::unique_ptr<Coloring> coloring(TreeImage::coloring_by_name(aRequest.count("coloring") ? aRequest["coloring"].get<std::string>() : std::string(), aTree));
+    auto const prepared = seconds_since(start);
+
+    tree_image.make_pdf(output, aTree, *coloring,
+                        aRequest.count("number_strains_threshold") ? aRequest["number_strains_threshold"].get<int>() : 0,
+                        aRequest.count("show_branch_ids") && aRequest["show_branch_ids"].get<bool>(),
+                        aRequest.count("show_subtree_top_bottom") && aRequest["show_subtree_top_bottom"].get<bool>());
+    auto const total = seconds_since(start);
+
+    return {
+        {"ok", true},
+        {"output", output},
+        {"timing", {{"prepare", prepared}, {"render", total - prepared}, {"total", total}}},
+        {"settings", tree_image.dump_to_json()},
+    };
+
+} // render_request
+
+// ----------------------------------------------------------------------
+
+void merge_settings(json& aTarget, const json& aPatch)
+{
+    if (aPatch.is_object() && aTarget.is_object()) {
+        for (auto entry = aPatch.begin(); entry != aPatch.end(); ++entry) {
+            if (aTarget.count(entry.key()))
+                merge_settings(aTarget[entry.key()], entry.value());
+            else
+                aTarget[entry.key()] = entry.value();
+        }
+    }
+    else {
+        aTarget = aPatch;
+    }
+
+} // merge_settings
+
+// ----------------------------------------------------------------------
+
+double seconds_since(std::chrono::steady_clock::time_point aStart)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - aStart).count();
+
+} // seconds_since
+
+// ----------------------------------------------------------------------
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+
+#include "json.hh"
+
+// ----------------------------------------------------------------------
+
+class Tree;
+
+// ----------------------------------------------------------------------
+
+  // Renders analysed tree according to request (used by tre2pdfd and tre2pdf-batch):
+  //   {"output": "/tmp/tree.pdf", "settings": {<patch for aSettings>}, "coloring": "continents" | "pos:<pos>" | "black",
+  //    "clades": false, "show_branch_ids": false, "show_subtree_top_bottom": false, "number_strains_threshold": 0}
+  // returns {"ok": true, "output": ..., "timing": {...}, "settings": {<computed settings>}}
+json render_request(const Tree& aTree, const json& aSettings, const json& aRequest);
+
+  // Objects are merged recursively, any other value in aPatch replaces the one in aTarget.
+void merge_settings(json& aTarget, const json& aPatch);
+
+double seconds_since(std::chrono::steady_clock::time_point aStart);
+
+// ----------------------------------------------------------------------
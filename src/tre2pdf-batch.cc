@@ -0,0 +1,218 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+
+#include "command-line-arguments.hh"
+
+#include "tree.hh"
+#include "tree-image.hh"
+#include "tree-import.hh"
+#include "read-file.hh"
+#include "compression.hh"
+#include "render.hh"
+#include "bounded-queue.hh"
+
+// ----------------------------------------------------------------------
+// Renders many trees with many colorings in one process, each tree is
+// read, parsed and analysed once. Manifest:
+//   {"jobs": <number of render threads, 0 - default>,
+//    "trees": [{"source": "h3.json.xz", "ladderize": true, "fix_labels": true, "settings": {<patch for _settings>},
+//               "renders": [<request, see render_request() in render.hh>, ...]}, ...]}
+// Stages read -> parse -> analyse -> render run concurrently connected by
+// bounded queues, so at most a few trees are kept in memory at a time.
+// ----------------------------------------------------------------------
+
+struct TreeJob
+{
+    json entry;                 // manifest entry
+    std::string data;           // source data, released after parsing
+    Tree tree;
+    json settings;              // _settings of the source patched by entry "settings"
+    std::string error;          // if not empty, tree could not be loaded
+};
+
+using TreeJobP = std::shared_ptr<TreeJob>;
+
+struct RenderTask
+{
+    TreeJobP tree_job;
+    json request;
+};
+
+static std::string string_field(const json& aObject, const char* aKey, const char* aFallback);
+template <typename Output> static void start_stage(std::vector<std::thread>& aThreads, size_t aNumberOfThreads, BoundedQueue<Output>& aOutput, std::function<void()> aWork);
+
+// ----------------------------------------------------------------------
+
+int main(int argc, const char *argv[])
+{
+    using command_line_arguments::Help;
+    using command_line_arguments::Arg;
+    auto cl = command_line_arguments::make_command_line_arguments
+            (
+                Arg<int>("jobs", 0, Help("Number of render threads (overrides \"jobs\" in manifest), 0 - half of the cores")),
+                Arg<command_line_arguments::PrintHelp>('h', "help", "Renders trees and colorings listed in the manifest.\nUsage: {progname} [options] <manifest.json>", Help("print this help screen"))
+             );
+    cl->min_max(1, 1);                  // one argument expected
+    try {
+        cl->parse(argc, argv);
+    }
+    catch (command_line_arguments::CommandLineError& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        cl->print_help(std::cerr);
+        return 1;
+    }
+
+    int exit_code = 0;
+    try {
+        auto const start = std::chrono::steady_clock::now();
+        const json manifest = json::parse(decompress_if_compressed(read_file(cl->arg(0))));
+        if (!manifest.count("trees") || !manifest["trees"].is_array())
+            throw std::runtime_error("\"trees\" is not in the manifest");
+        int jobs = cl->get<int>("jobs");
+        if (jobs <= 0 && manifest.count("jobs"))
+            jobs = manifest["jobs"].get<int>();
+        const size_t render_threads = jobs > 0 ? static_cast<size_t>(jobs) : std::max(1U, std::thread::hardware_concurrency() / 2); // each render draws panels in parallel too
+
+        BoundedQueue<TreeJobP> read_queue(2), parse_queue(2);
+        BoundedQueue<RenderTask> render_queue(render_threads * 2);
+        std::mutex report_access;
+        std::atomic<size_t> failed(0), rendered(0);
+        auto report_failure = [&](std::string aWhat, std::string aError) {
+            std::unique_lock<std::mutex> lock(report_access);
+            std::cerr << "ERROR: " << aWhat << ": " << aError << std::endl;
+            ++failed;
+        };
+
+        std::vector<std::thread> threads;
+          // read: source file is read and decompressed
+        start_stage(threads, 1, read_queue, [&]() {
+                for (const auto& entry: manifest["trees"]) {
+                    TreeJobP job(new TreeJob);
+                    job->entry = entry;
+                    try {
+                        job->data = decompress_if_compressed(read_file(entry["source"].get<std::string>()));
+                    }
+                    catch (std::exception& err) {
+                        job->error = err.what();
+                    }
+                    read_queue.push(job);
+                }
+            });
+          // parse: newick or json
+        start_stage(threads, 2, parse_queue, [&]() {
+                TreeJobP job;
+                while (read_queue.pop(job)) {
+                    if (job->error.empty()) {
+                        try {
+                            TreeImage tree_image;
+                            import_tree_from_data(job->tree, std::move(job->data), tree_image);
+                            job->settings = tree_image.dump_to_json();
+                            if (job->entry.count("settings"))
+                                merge_settings(job->settings, job->entry["settings"]);
+                        }
+                        catch (std::exception& err) {
+                            job->error = err.what();
+                        }
+                    }
+                    job->data.clear();
+                    job->data.shrink_to_fit();
+                    parse_queue.push(job);
+                }
+            });
+          // analyse: tree layout (ladderizing, line numbers, subtree boundaries) shared by all renders of the tree
+        start_stage(threads, 1, render_queue, [&]() {
+                TreeJobP job;
+                while (parse_queue.pop(job)) {
+                    if (job->error.empty()) {
+                        try {
+                            if (job->entry.count("ladderize") && job->entry["ladderize"].get<bool>())
+                                job->tree.ladderize();
+                            job->tree.analyse();
+                            if (job->entry.count("fix_labels") && job->entry["fix_labels"].get<bool>())
+                                job->tree.fix_labels();
+                        }
+                        catch (std::exception& err) {
+                            job->error = err.what();
+                        }
+                    }
+                    if (!job->error.empty()) {
+                        report_failure(string_field(job->entry, "source", "tree without source"), job->error);
+                        continue;
+                    }
+                    if (job->entry.count("renders")) {
+                        for (const auto& request: job->entry["renders"])
+                            render_queue.push({job, request});
+                    }
+                }
+            });
+          // render: tree job is released when its last render finishes
+        std::vector<std::thread> render_workers;
+        for (size_t worker = 0; worker < render_threads; ++worker) {
+            render_workers.emplace_back([&]() {
+                    RenderTask task;
+                    while (render_queue.pop(task)) {
+                        try {
+                            auto const response = render_request(task.tree_job->tree, task.tree_job->settings, task.request);
+                            std::unique_lock<std::mutex> lock(report_access);
+                            std::cout << response["output"].get<std::string>() << ": " << response["timing"]["total"].get<double>() << "s" << std::endl;
+                            ++rendered;
+                        }
+                        catch (std::exception& err) {
+                            report_failure(string_field(task.request, "output", "render without output"), err.what());
+                        }
+                        task = RenderTask();
+                    }
+                });
+        }
+        for (auto& thread: threads)
+            thread.join();
+        for (auto& thread: render_workers)
+            thread.join();
+
+        std::cout << "Rendered: " << rendered << "  failed: " << failed << "  time: " << seconds_since(start) << "s" << std::endl;
+        if (failed)
+            exit_code = 1;
+    }
+    catch (std::exception& err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        exit_code = 1;
+    }
+    return exit_code;
+}
+
+// ----------------------------------------------------------------------
+
+  // For failure reports, must not throw whatever is in the manifest
+static std::string string_field(const json& aObject, const char* aKey, const char* aFallback)
+{
+    if (aObject.is_object() && aObject.count(aKey)) {
+        const auto& value = aObject[aKey];
+        return value.is_string() ? value.get<std::string>() : value.dump();
+    }
+    return aFallback;
+
+} // string_field
+
+// ----------------------------------------------------------------------
+
+  // Starts aNumberOfThreads threads running aWork, aOutput is closed when the last of them finishes.
+template <typename Output> static void start_stage(std::vector<std::thread>& aThreads, size_t aNumberOfThreads, BoundedQueue<Output>& aOutput, std::function<void()> aWork)
+{
+    auto remaining = std::make_shared<std::atomic<size_t>>(aNumberOfThreads);
+    for (size_t thread_no = 0; thread_no < aNumberOfThreads; ++thread_no) {
+        aThreads.emplace_back([remaining, &aOutput, aWork]() {
+                aWork();
+                if (--*remaining == 0)
+                    aOutput.close();
+            });
+    }
+
+} // start_stage
+
+// ----------------------------------------------------------------------
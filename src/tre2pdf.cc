@@ -1,5 +1,6 @@
 #include <iostream>
 #include <string>
+#include <sys/stat.h>
 
 #include "command-line-arguments.hh"
 
@@ -9,6 +10,10 @@
 
 // ----------------------------------------------------------------------
 
+static std::string file_key(std::string aFilename);
+
+// ----------------------------------------------------------------------
+
 int main(int argc, const char *argv[])
 {
     using command_line_arguments::Help;
@@ -26,7 +31,14 @@ int main(int argc, const char *argv[])
                 Arg<bool>("ladderize", false, Help("Ladderize the tree before drawing")),
                 Arg<int>("number-strains-threshold", 0, Help("Do not put branch annotation if \"number_strains\" for the branch is less than this value.")),
                 Arg<std::string>("save", std::string(), Help("Save ladderized tree, - for stdout")),
-                Arg<command_line_arguments::PrintHelp>('h', "help", "Usage: {progname} [options] <source.json> <output.pdf>", Help("print this help screen"))
+                Arg<double>("png-scale", 4.0, Help("Pixels per point when output is .png")),
+                Arg<double>("min-font-size", -1.0, Help("Do not make labels smaller than this, split tree into several pages instead (overrides _settings.tree.min_font_size)")),
+                Arg<std::string>("cache", std::string(), Help("Keep drawings of panels (tree, time series, clades, title, legend) in this directory, redraw only panels whose settings or data changed")),
+                Arg<double>("lod", -1.0, Help("Draw subtrees spanning less than this many points vertically as a wedge with the number of leaves (overrides _settings.tree.lod_min_height)")),
+                Arg<std::string>("subtree", std::string(), Help("Draw only the subtree with this branch_id")),
+                Arg<std::string>("keep", std::string(), Help("Remove leaves not listed in this file (one name per line)")),
+                Arg<bool>("statistics", false, Help("Print text extents and font cache statistics after drawing")),
+                Arg<command_line_arguments::PrintHelp>('h', "help", "Usage: {progname} [options] <source.json> <output.pdf|output.png>", Help("print this help screen"))
              );
     cl->min_max(2, 2);                  // one argument expected
     try {
@@ -43,6 +55,10 @@ int main(int argc, const char *argv[])
         Tree tre;
         TreeImage tree_image;
         import_tree(tre, cl->arg(0), tree_image);
+        if (!cl->get<std::string>("subtree").empty())
+            tre.extract_subtree(cl->get<std::string>("subtree"));
+        if (!cl->get<std::string>("keep").empty())
+            tre.prune(read_source_list(cl->get<std::string>("keep")));
         if (cl->get<bool>("ladderize")) {
             tre.ladderize();
         }
@@ -77,7 +93,24 @@ int main(int argc, const char *argv[])
             tre.fix_labels();
 
         tree_image.clades().show(cl->get<bool>("clades"));
+        tree_image.raster_scale(cl->get<double>("png-scale"));
+        if (!cl->get<std::string>("cache").empty()) {
+              // tree source and options changing the tree, the tree is hashed only if they change
+            std::string tree_key;
+            if (cl->arg(0) != "-") {
+                tree_key = file_key(cl->arg(0)) + " subtree:" + cl->get<std::string>("subtree") + " ladderize:" + std::to_string(cl->get<bool>("ladderize")) + " fix-labels:" + std::to_string(cl->get<bool>("fix-labels"));
+                if (!cl->get<std::string>("keep").empty())
+                    tree_key += " keep:" + file_key(cl->get<std::string>("keep"));
+            }
+            tree_image.cache_directory(cl->get<std::string>("cache"), tree_key);
+        }
+        if (cl->get<double>("min-font-size") >= 0.0)
+            tree_image.tree().min_font_size(cl->get<double>("min-font-size"));
+        if (cl->get<double>("lod") >= 0.0)
+            tree_image.tree().lod_min_height(cl->get<double>("lod"));
         tree_image.make_pdf(cl->arg(1), tre, *coloring, cl->get<int>("number-strains-threshold"), cl->get<bool>("show-branch-ids"), cl->get<bool>("show-subtree-top-bottom"));
+        if (cl->get<bool>("statistics"))
+            tree_image.surface().print_statistics(std::cout);
         std::cout << "Computed values (can be inserted into source.json at \"_settings\" key):" << std::endl << tree_image.dump_to_json().dump(2) << std::endl;
     }
     catch (std::exception& err) {
@@ -87,4 +120,16 @@ int main(int argc, const char *argv[])
     return exit_code;
 }
 
+// ----------------------------------------------------------------------
+
+  // name, size and modification time, changes when the file is rewritten
+static std::string file_key(std::string aFilename)
+{
+    struct stat st;
+    if (stat(aFilename.c_str(), &st) != 0)
+        throw std::runtime_error("cannot stat " + aFilename);
+    return aFilename + ":" + std::to_string(st.st_size) + ":" + std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec);
+
+} // file_key
+
 // ----------------------------------------------------------------------
@@ -0,0 +1,197 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "command-line-arguments.hh"
+
+#include "tree.hh"
+#include "tree-image.hh"
+#include "tree-import.hh"
+#include "render.hh"
+
+// ----------------------------------------------------------------------
+// Tree is imported, ladderized and analysed once, then pdf/png images are
+// rendered on request received via unix domain socket. Each request is one
+// line of json (see render_request() in render.hh), the response is one
+// line of json, {"ok": false, "error": "..."} if rendering failed.
+// {"quit": true} stops the daemon. Connections are served one at a time,
+// a connection idle (nothing received) for --idle-timeout seconds is
+// closed, so a stalled client cannot block other clients for longer.
+// ----------------------------------------------------------------------
+
+class Daemon
+{
+ public:
+    inline Daemon(const Tree& aTree, const json& aSettings, int aIdleTimeout) : mTree(aTree), mSettings(aSettings), mIdleTimeout(aIdleTimeout) {}
+
+    void listen(std::string aSocketPath);
+
+ private:
+    const Tree& mTree;
+    const json mSettings;       // _settings of the source, requests patch them
+    const int mIdleTimeout;     // seconds, 0 - wait for the client forever
+
+    bool serve(int aConnection); // returns false if quit requested
+    json render(const json& aRequest);
+};
+
+// ----------------------------------------------------------------------
+
+int main(int argc, const char *argv[])
+{
+    using command_line_arguments::Help;
+    using command_line_arguments::Arg;
+    auto cl = command_line_arguments::make_command_line_arguments
+            (
+                Arg<bool>("fix-labels", false, Help("Remove /HUMAN/ from labels, remove (H3N2) atc. from labels before drawing them")),
+                Arg<bool>("ladderize", false, Help("Ladderize the tree before drawing")),
+                Arg<int>("idle-timeout", 30, Help("Close connection if client sends nothing for this many seconds, 0 - never")),
+                Arg<command_line_arguments::PrintHelp>('h', "help", "Loads tree once and renders it on requests received via unix domain socket.\nUsage: {progname} [options] <source.json> <socket>", Help("print this help screen"))
+             );
+    cl->min_max(2, 2);                  // two arguments expected
+    try {
+        cl->parse(argc, argv);
+    }
+    catch (command_line_arguments::CommandLineError& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        cl->print_help(std::cerr);
+        return 1;
+    }
+
+    int exit_code = 0;
+    try {
+        auto const start = std::chrono::steady_clock::now();
+        Tree tre;
+        TreeImage tree_image;
+        import_tree(tre, cl->arg(0), tree_image);
+        if (cl->get<bool>("ladderize"))
+            tre.ladderize();
+        tre.analyse();
+        if (cl->get<bool>("fix-labels"))
+            tre.fix_labels();
+        std::cout << "Tree loaded in " << seconds_since(start) << "s" << std::endl;
+
+        std::signal(SIGPIPE, SIG_IGN); // client may disconnect before reading response
+        Daemon daemon(tre, tree_image.dump_to_json(), cl->get<int>("idle-timeout"));
+        daemon.listen(cl->arg(1));
+    }
+    catch (std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        exit_code = 1;
+    }
+    return exit_code;
+}
+
+// ----------------------------------------------------------------------
+
+void Daemon::listen(std::string aSocketPath)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (aSocketPath.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("socket path is too long: " + aSocketPath);
+    std::strcpy(address.sun_path, aSocketPath.c_str());
+
+    const int server = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0)
+        throw std::runtime_error(std::string("cannot create socket: ") + std::strerror(errno));
+    ::unlink(aSocketPath.c_str()); // left by the previous run
+    if (::bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(server, 16) != 0) {
+        const std::string error = std::strerror(errno);
+        ::close(server);
+        throw std::runtime_error("cannot listen on " + aSocketPath + ": " + error);
+    }
+    std::cout << "Listening on " << aSocketPath << std::endl;
+
+    for (bool running = true; running; ) {
+        const int connection = ::accept(server, nullptr, nullptr);
+        if (connection < 0) {
+            if (errno == EINTR)
+                continue;
+            ::close(server);
+            throw std::runtime_error(std::string("accept failed: ") + std::strerror(errno));
+        }
+        if (mIdleTimeout > 0) {
+            timeval timeout;
+            timeout.tv_sec = mIdleTimeout;
+            timeout.tv_usec = 0;
+            if (::setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 || ::setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0)
+                std::cerr << "WARNING: cannot set connection timeout: " << std::strerror(errno) << std::endl;
+        }
+        running = serve(connection);
+        ::close(connection);
+    }
+    ::close(server);
+    ::unlink(aSocketPath.c_str());
+
+} // Daemon::listen
+
+// ----------------------------------------------------------------------
+
+  // Requests of one connection are handled in order, the connection is
+  // closed by the client, after quit request or when read/write times out
+  // (EAGAIN, see mIdleTimeout).
+bool Daemon::serve(int aConnection)
+{
+    std::string received;
+    char buffer[65536];
+    while (true) {
+        const ssize_t bytes = ::read(aConnection, buffer, sizeof(buffer));
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            std::cerr << "Connection idle for " << mIdleTimeout << "s, closed" << std::endl;
+        if (bytes <= 0)
+            break;
+        received.append(buffer, static_cast<size_t>(bytes));
+        for (auto eol = received.find('\n'); eol != std::string::npos; eol = received.find('\n')) {
+            const std::string line(received, 0, eol);
+            received.erase(0, eol + 1);
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+            json response;
+            bool quit = false;
+            try {
+                const json request = json::parse(line);
+                quit = request.count("quit") && request["quit"].get<bool>();
+                response = quit ? json{{"ok", true}} : render(request);
+            }
+            catch (std::exception& err) {
+                response = {{"ok", false}, {"error", err.what()}};
+            }
+            const std::string data = response.dump() + "\n";
+            for (size_t written = 0; written < data.size(); ) {
+                const ssize_t bytes_written = ::write(aConnection, data.c_str() + written, data.size() - written);
+                if (bytes_written < 0 && errno == EINTR)
+                    continue;
+                if (bytes_written <= 0)
+                    return !quit;    // client disconnected
+                written += static_cast<size_t>(bytes_written);
+            }
+            if (quit)
+                return false;
+        }
+    }
+    return true;
+
+} // Daemon::serve
+
+// ----------------------------------------------------------------------
+
+json Daemon::render(const json& aRequest)
+{
+    auto response = render_request(mTree, mSettings, aRequest);
+    std::cout << response["output"].get<std::string>() << ": " << response["timing"]["total"].get<double>() << "s" << std::endl;
+    return response;
+
+} // Daemon::render
+
+// ----------------------------------------------------------------------
@@ -0,0 +1,344 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+
+#include "command-line-arguments.hh"
+
+#include "tree.hh"
+#include "tree-import.hh"
+#include "parallel-for.hh"
+#include "bipartition.hh"
+
+// ----------------------------------------------------------------------
+// Majority rule consensus. Pass 1 imports trees in parallel and counts
+// their splits by hash, pass 2 re-imports only the trees needed to
+// recover leaves of the splits kept. At most one tree per thread is in
+// memory at a time. All trees must have the same leaf set.
+// ----------------------------------------------------------------------
+
+// fake TreeImage to avoid linking in real one (and cairo), consensus is written with empty _settings
+class TreeImage
+{
+ public:
+    void load_from_json(const json&);
+    json dump_to_json() const;
+};
+
+void TreeImage::load_from_json(const json&) {}
+json TreeImage::dump_to_json() const { return json::object(); }
+
+// ----------------------------------------------------------------------
+
+struct Cluster
+{
+    size_t count;               // number of trees having the split
+    double edge_length_sum;
+    size_t first_tree;          // index of the first tree having the split, used to recover members
+    std::vector<size_t> members; // leaf indices of the side without leaf 0 (consensus is rooted there), sorted
+};
+
+class LeafIndex
+{
+ public:
+    LeafIndex(const Tree& aTree, const LeafHashes& aLeaves);
+
+    inline size_t size() const { return mNames.size(); }
+    inline std::string name(size_t aIndex) const { return mNames[aIndex]; }
+    size_t operator[](std::string aName) const;
+
+ private:
+    std::vector<std::string> mNames; // in the order of the first tree
+    std::unordered_map<std::string, size_t> mIndex;
+};
+
+static std::vector<size_t> leaf_order(const Node& aNode, const LeafIndex& aLeafIndex, const LeafHashes& aLeaves, const std::unordered_map<uint64_t, size_t>& aWanted, std::vector<std::pair<size_t, std::pair<size_t, size_t>>>& aFound);
+static void assemble(Tree& aTree, const std::vector<Cluster>& aClusters, const LeafIndex& aLeafIndex, const std::vector<double>& aLeafEdgeLengths, size_t aNumberOfTrees);
+
+// ----------------------------------------------------------------------
+
+int main(int argc, const char *argv[])
+{
+    using command_line_arguments::Help;
+    using command_line_arguments::Arg;
+    auto cl = command_line_arguments::make_command_line_arguments
+            (
+                Arg<double>("threshold", 0.5, Help("Keep clusters found in more than this fraction of trees, clusters incompatible with more frequent ones are dropped if below 0.5")),
+                Arg<int>("jobs", 0, Help("Number of threads, 0 - all cores")),
+                Arg<command_line_arguments::PrintHelp>('h', "help", "Builds majority rule consensus of the trees listed in <trees.txt> (one source per line), support (percent) is stored in names of subtree nodes.\nUsage: {progname} [options] <trees.txt> <output.json>", Help("print this help screen"))
+             );
+    cl->min_max(2, 2);                  // two arguments expected
+    try {
+        cl->parse(argc, argv);
+    }
+    catch (command_line_arguments::CommandLineError& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        cl->print_help(std::cerr);
+        return 1;
+    }
+
+    int exit_code = 0;
+    try {
+        const auto sources = read_source_list(cl->arg(0));
+        if (sources.empty())
+            throw std::runtime_error("no trees listed in " + cl->arg(0));
+        const int jobs = cl->get<int>("jobs");
+        const size_t threads = jobs > 0 ? static_cast<size_t>(jobs) : std::max(1U, std::thread::hardware_concurrency());
+
+        std::unique_ptr<LeafHashes> leaves;
+        std::unique_ptr<LeafIndex> leaf_index;
+        {
+            Tree first;
+            TreeImage tree_image;
+            import_tree(first, sources.front(), tree_image);
+            leaves.reset(new LeafHashes({&first}));
+            leaf_index.reset(new LeafIndex(first, *leaves));
+        }
+
+          // pass 1: count splits
+        std::unordered_map<uint64_t, Cluster> clusters;
+        std::vector<double> leaf_edge_lengths(leaf_index->size(), 0.0);
+        std::mutex clusters_access;
+        parallel_for(sources.size(), threads, [&](size_t aTreeNo) {
+                Tree tree;
+                TreeImage tree_image;
+                import_tree(tree, sources[aTreeNo], tree_image);
+                std::vector<std::pair<size_t, double>> leaf_edges;
+                iterate(static_cast<const Node&>(tree), [&](const Node& aNode) { leaf_edges.emplace_back((*leaf_index)[aNode.name], aNode.edge_length); });
+                if (leaf_edges.size() != leaf_index->size())
+                    throw std::runtime_error(sources[aTreeNo] + ": leaf set differs from the one of " + sources.front());
+                const auto splits = tree_splits(tree, *leaves);
+
+                std::unique_lock<std::mutex> lock(clusters_access);
+                for (const auto& split: splits) {
+                    auto& cluster = clusters.emplace(split.hash, Cluster{0, 0.0, aTreeNo, {}}).first->second;
+                    ++cluster.count;
+                    cluster.edge_length_sum += split.edge_length;
+                    cluster.first_tree = std::min(cluster.first_tree, aTreeNo);
+                }
+                for (const auto& leaf_edge: leaf_edges)
+                    leaf_edge_lengths[leaf_edge.first] += leaf_edge.second;
+            });
+
+        const double threshold = cl->get<double>("threshold");
+        std::vector<Cluster> kept;
+        std::unordered_map<uint64_t, size_t> wanted; // split hash -> index in kept
+        for (auto& hash_cluster: clusters) {
+            if (static_cast<double>(hash_cluster.second.count) > threshold * static_cast<double>(sources.size())) {
+                wanted.emplace(hash_cluster.first, kept.size());
+                kept.push_back(std::move(hash_cluster.second));
+            }
+        }
+        clusters.clear();
+        std::cout << "Trees: " << sources.size() << "  leaves: " << leaf_index->size() << "  clusters kept: " << kept.size() << std::endl;
+
+          // pass 2: recover members of kept clusters from the first tree having each of them
+        std::vector<size_t> trees_to_read;
+        for (const auto& cluster: kept)
+            trees_to_read.push_back(cluster.first_tree);
+        std::sort(trees_to_read.begin(), trees_to_read.end());
+        trees_to_read.erase(std::unique(trees_to_read.begin(), trees_to_read.end()), trees_to_read.end());
+        parallel_for(trees_to_read.size(), threads, [&](size_t aIndex) {
+                const size_t tree_no = trees_to_read[aIndex];
+                Tree tree;
+                TreeImage tree_image;
+                import_tree(tree, sources[tree_no], tree_image);
+                std::vector<std::pair<size_t, std::pair<size_t, size_t>>> found; // index in kept -> range in order
+                const auto order = leaf_order(tree, *leaf_index, *leaves, wanted, found);
+                for (const auto& cluster_range: found) {
+                    auto& cluster = kept[cluster_range.first];
+                    if (cluster.first_tree != tree_no || !cluster.members.empty())
+                        continue; // members are recovered by another thread
+                    const auto range_begin = order.begin() + static_cast<long>(cluster_range.second.first), range_end = order.begin() + static_cast<long>(cluster_range.second.second);
+                    if (std::find(range_begin, range_end, size_t(0)) == range_end) {
+                        cluster.members.assign(range_begin, range_end);
+                    }
+                    else {
+                        cluster.members.assign(order.begin(), range_begin);
+                        cluster.members.insert(cluster.members.end(), range_end, order.end());
+                    }
+                    std::sort(cluster.members.begin(), cluster.members.end());
+                }
+            });
+
+        Tree consensus;
+        assemble(consensus, kept, *leaf_index, leaf_edge_lengths, sources.size());
+        TreeImage tree_image;
+        tree_to_json(consensus, cl->arg(1), "treconsensus", tree_image);
+    }
+    catch (std::exception& err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        exit_code = 1;
+    }
+    return exit_code;
+}
+
+// ----------------------------------------------------------------------
+
+LeafIndex::LeafIndex(const Tree& aTree, const LeafHashes& aLeaves)
+{
+    iterate(static_cast<const Node&>(aTree), [&](const Node& aNode) {
+            if (aLeaves[aNode.name]) {
+                mIndex.emplace(aNode.name, mNames.size());
+                mNames.push_back(aNode.name);
+            }
+        });
+
+} // LeafIndex::LeafIndex
+
+// ----------------------------------------------------------------------
+
+size_t LeafIndex::operator[](std::string aName) const
+{
+    auto const found = mIndex.find(aName);
+    if (found == mIndex.end())
+        throw std::runtime_error("unexpected leaf (not found in the first tree or repeated there): " + aName);
+    return found->second;
+
+} // LeafIndex::operator[]
+
+// ----------------------------------------------------------------------
+
+  // Returns leaf indices in the tree order, aFound gets ranges of the order
+  // covered by subtrees having wanted splits.
+static uint64_t collect_leaf_order(const Node& aNode, const LeafIndex& aLeafIndex, const LeafHashes& aLeaves, const std::unordered_map<uint64_t, size_t>& aWanted, std::vector<size_t>& aOrder, std::vector<std::pair<size_t, std::pair<size_t, size_t>>>& aFound)
+{
+    if (aNode.is_leaf()) {
+        aOrder.push_back(aLeafIndex[aNode.name]);
+        return aLeaves[aNode.name];
+    }
+    const size_t begin = aOrder.size();
+    uint64_t hash = 0;
+    for (const auto& node: aNode.subtree)
+        hash ^= collect_leaf_order(node, aLeafIndex, aLeaves, aWanted, aOrder, aFound);
+    auto const wanted = aWanted.find(std::min(hash, hash ^ aLeaves.all()));
+    if (wanted != aWanted.end())
+        aFound.emplace_back(wanted->second, std::make_pair(begin, aOrder.size()));
+    return hash;
+
+} // collect_leaf_order
+
+static std::vector<size_t> leaf_order(const Node& aNode, const LeafIndex& aLeafIndex, const LeafHashes& aLeaves, const std::unordered_map<uint64_t, size_t>& aWanted, std::vector<std::pair<size_t, std::pair<size_t, size_t>>>& aFound)
+{
+    std::vector<size_t> order;
+    order.reserve(aLeafIndex.size());
+    collect_leaf_order(aNode, aLeafIndex, aLeaves, aWanted, order, aFound);
+    return order;
+
+} // leaf_order
+
+// ----------------------------------------------------------------------
+
+  // Clusters are inserted by decreasing frequency (then size), so a
+  // cluster incompatible with more frequent ones already inserted is
+  // dropped. Cluster C is inserted under P, the smallest node containing
+  // all its leaves, it is compatible if every child of P it touches lies
+  // completely in C; these children become children of the new node.
+static void assemble(Tree& aTree, const std::vector<Cluster>& aClusters, const LeafIndex& aLeafIndex, const std::vector<double>& aLeafEdgeLengths, size_t aNumberOfTrees)
+{
+    std::vector<const Cluster*> by_count;
+    for (const auto& cluster: aClusters)
+        by_count.push_back(&cluster);
+    std::sort(by_count.begin(), by_count.end(), [](const Cluster* a, const Cluster* b) {
+            if (a->count != b->count)
+                return a->count > b->count;
+            return a->members.size() > b->members.size() || (a->members.size() == b->members.size() && a->members < b->members);
+        });
+
+    std::vector<const Cluster*> nodes{nullptr}; // node 0 is the root
+    std::vector<size_t> node_parent{0};
+    std::vector<size_t> node_size{aLeafIndex.size()};
+    std::vector<size_t> leaf_parent(aLeafIndex.size(), 0);
+    size_t dropped = 0;
+    for (const auto* cluster: by_count) {
+          // P: walk up from the parent of the first leaf, then lift to cover parents of other leaves
+        std::unordered_map<size_t, size_t> ancestors; // node -> distance from the parent of the first leaf
+        for (size_t node = leaf_parent[cluster->members.front()], step = 0; ; node = node_parent[node], ++step) {
+            ancestors.emplace(node, step);
+            if (node == 0)
+                break;
+        }
+        size_t top_step = 0;
+        for (auto leaf: cluster->members) {
+            size_t node = leaf_parent[leaf];
+            for (; ancestors.find(node) == ancestors.end(); node = node_parent[node]);
+            top_step = std::max(top_step, ancestors[node]);
+        }
+        size_t parent = leaf_parent[cluster->members.front()];
+        for (size_t step = 0; step < top_step; ++step)
+            parent = node_parent[parent];
+
+          // children of P touched by the cluster and number of its leaves in each of them
+        std::unordered_map<size_t, size_t> touched;
+        std::vector<size_t> direct_leaves;
+        for (auto leaf: cluster->members) {
+            if (leaf_parent[leaf] == parent) {
+                direct_leaves.push_back(leaf);
+            }
+            else {
+                size_t node = leaf_parent[leaf];
+                for (; node_parent[node] != parent; node = node_parent[node]);
+                ++touched[node];
+            }
+        }
+        if (std::any_of(touched.begin(), touched.end(), [&node_size](const std::pair<const size_t, size_t>& aTouched) { return aTouched.second != node_size[aTouched.first]; })) {
+            ++dropped;
+            continue;
+        }
+
+        const size_t inserted = nodes.size();
+        nodes.push_back(cluster);
+        node_parent.push_back(parent);
+        node_size.push_back(cluster->members.size());
+        for (auto leaf: direct_leaves)
+            leaf_parent[leaf] = inserted;
+        for (const auto& child: touched)
+            node_parent[child.first] = inserted;
+    }
+    if (dropped)
+        std::cerr << "WARNING: " << dropped << " incompatible clusters dropped" << std::endl;
+
+      // children of each node ordered by their first leaf (in the order of the first tree)
+    std::vector<std::vector<std::pair<size_t, bool>>> children(nodes.size()); // (leaf or node index, is_leaf)
+    std::vector<size_t> first_leaf(nodes.size(), aLeafIndex.size());
+    for (size_t leaf = 0; leaf < aLeafIndex.size(); ++leaf) {
+        children[leaf_parent[leaf]].emplace_back(leaf, true);
+        for (size_t node = leaf_parent[leaf]; first_leaf[node] > leaf; node = node_parent[node]) {
+            first_leaf[node] = leaf;
+            if (node == 0)
+                break;
+        }
+    }
+    for (size_t node = 1; node < nodes.size(); ++node)
+        children[node_parent[node]].emplace_back(node, false);
+    auto const first_leaf_of = [&first_leaf](const std::pair<size_t, bool>& a) { return a.second ? a.first : first_leaf[a.first]; };
+    for (auto& node_children: children)
+        std::sort(node_children.begin(), node_children.end(), [&](const std::pair<size_t, bool>& a, const std::pair<size_t, bool>& b) { return first_leaf_of(a) < first_leaf_of(b); });
+
+    const double number_of_trees = static_cast<double>(aNumberOfTrees);
+    std::function<void(Node&, size_t)> fill = [&](Node& aNode, size_t aNodeNo) {
+        for (const auto& child: children[aNodeNo]) {
+            if (child.second) {
+                aNode.subtree.emplace_back(aLeafIndex.name(child.first), aLeafEdgeLengths[child.first] / number_of_trees);
+            }
+            else {
+                const auto* cluster = nodes[child.first];
+                aNode.subtree.emplace_back();
+                Node& node = aNode.subtree.back();
+                node.edge_length = cluster->edge_length_sum / static_cast<double>(cluster->count);
+                node.name = std::to_string(std::lround(static_cast<double>(cluster->count) * 100.0 / number_of_trees));
+                fill(node, child.first);
+            }
+        }
+    };
+    fill(aTree, 0);
+
+} // assemble
+
+// ----------------------------------------------------------------------
@@ -1,10 +1,16 @@
 #include <iostream>
+#include <fstream>
 #include <string>
+#include <vector>
+#include <thread>
 
 #include "command-line-arguments.hh"
 
 #include "tree.hh"
 #include "tree-import.hh"
+#include "parallel-for.hh"
+#include "bipartition.hh"
+#include "leaf-placement.hh"
 
 // ----------------------------------------------------------------------
 
@@ -19,14 +25,24 @@ class TreeImage
 void TreeImage::load_from_json(const json&) {}
 json TreeImage::dump_to_json() const { return json(); }
 
+static void report_robinson_foulds(const Tree& aTree1, const Tree& aTree2, std::string aSource1, std::string aSource2, bool aMembers);
+static void report_only_in(std::string aSource, const std::vector<const Split*>& aSplits, const LeafHashes& aLeaves, bool aMembers);
+static void distance_matrix(std::string aTreeList, std::string aOutput, size_t aNumberOfThreads);
+
 // ----------------------------------------------------------------------
+
 int main(int argc, const char *argv[])
 {
     using command_line_arguments::Help;
     using command_line_arguments::Arg;
     auto cl = command_line_arguments::make_command_line_arguments
             (
-                Arg<command_line_arguments::PrintHelp>('h', "help", "Usage: {progname} [options] <source1.json> <source2.json>", Help("print this help screen"))
+                Arg<bool>("matrix", false, Help("<source1.json> is a file listing trees (one source per line), RF and weighted RF distances of every pair of them are written to <source2.json> (.json - json, otherwise tsv)")),
+                Arg<int>("jobs", 0, Help("Number of threads for --matrix, 0 - all cores")),
+                Arg<bool>("placement", false, Help("report added, removed, moved (branch_id or clades changed) and displaced (line order changed) leaves as json")),
+                Arg<bool>("ladderize", false, Help("ladderize trees before comparing line order (--placement)")),
+                Arg<bool>("members", false, Help("list leaves of the clusters found in one tree only, otherwise just the first and the last leaf")),
+                Arg<command_line_arguments::PrintHelp>('h', "help", "Reports Robinson-Foulds distance and clusters found in one of the trees only or (--placement) leaf placement changes.\nUsage: {progname} [options] <source1.json> <source2.json>", Help("print this help screen"))
              );
     cl->min_max(2, 2);                  // two arguments expected
     try {
@@ -40,10 +56,29 @@ int main(int argc, const char *argv[])
 
     int exit_code = 0;
     try {
+        if (cl->get<bool>("matrix")) {
+            const int jobs = cl->get<int>("jobs");
+            distance_matrix(cl->arg(0), cl->arg(1), jobs > 0 ? static_cast<size_t>(jobs) : std::max(1U, std::thread::hardware_concurrency()));
+            return 0;
+        }
+
         Tree tre1, tre2;
         TreeImage tree_image;
         import_tree(tre1, cl->arg(0), tree_image);
         import_tree(tre2, cl->arg(1), tree_image);
+
+        if (cl->get<bool>("placement")) {
+            if (cl->get<bool>("ladderize")) {
+                tre1.ladderize();
+                tre2.ladderize();
+            }
+            tre1.analyse();
+            tre2.analyse();
+            std::cout << leaf_placement_diff(tre1, tre2).dump(2) << std::endl;
+        }
+        else {
+            report_robinson_foulds(tre1, tre2, cl->arg(0), cl->arg(1), cl->get<bool>("members"));
+        }
     }
     catch (std::exception& err) {
         std::cerr << err.what() << std::endl;
@@ -52,4 +87,127 @@ int main(int argc, const char *argv[])
     return exit_code;
 }
 
+// ----------------------------------------------------------------------
+
+  // Robinson-Foulds distance and clusters found in one of the trees only
+static void report_robinson_foulds(const Tree& aTree1, const Tree& aTree2, std::string aSource1, std::string aSource2, bool aMembers)
+{
+    const LeafHashes leaves({&aTree1, &aTree2});
+    if (leaves.size() < 4)
+        throw std::runtime_error("too few common leaves to compare: " + std::to_string(leaves.size()));
+    auto const splits1 = tree_splits(aTree1, leaves), splits2 = tree_splits(aTree2, leaves);
+    auto const diff = compare_splits(splits1, splits2);
+
+    std::cout << "Common leaves: " << leaves.size() << std::endl;
+    std::cout << "Leaves only in " << aSource1 << ": " << number_of_uncommon_leaves(aTree1, leaves) << std::endl;
+    std::cout << "Leaves only in " << aSource2 << ": " << number_of_uncommon_leaves(aTree2, leaves) << std::endl;
+    std::cout << "Splits: " << splits1.size() << " " << splits2.size() << std::endl;
+    std::cout << "RF distance: " << diff.robinson_foulds();
+    if (!splits1.empty() || !splits2.empty())
+        std::cout << "  normalized: " << static_cast<double>(diff.robinson_foulds()) / static_cast<double>(splits1.size() + splits2.size());
+    std::cout << std::endl;
+    std::cout << "Weighted RF distance: " << diff.weighted << std::endl;
+    report_only_in(aSource1, diff.only_in_first, leaves, aMembers);
+    report_only_in(aSource2, diff.only_in_second, leaves, aMembers);
+
+} // report_robinson_foulds
+
+// ----------------------------------------------------------------------
+
+  // Clusters are listed by common leaves of the subtree on one side of the split
+static void report_only_in(std::string aSource, const std::vector<const Split*>& aSplits, const LeafHashes& aLeaves, bool aMembers)
+{
+    std::cout << std::endl << "Clusters only in " << aSource << ": " << aSplits.size() << std::endl;
+    for (const auto* split: aSplits) {
+        auto const members = split_members(*split, aLeaves);
+        std::cout << "  " << split->size << " leaves";
+        if (!split->node->branch_id.empty())
+            std::cout << " [" << split->node->branch_id << "]";
+        if (aMembers) {
+            std::cout << ":";
+            for (const auto& name: members)
+                std::cout << ' ' << name;
+        }
+        else {
+            std::cout << ": " << members.front() << " .. " << members.back();
+        }
+        std::cout << std::endl;
+    }
+
+} // report_only_in
+
+// ----------------------------------------------------------------------
+
+  // Splits of each tree are collected once over the leaves common to all
+  // the trees, then distances of all pairs are computed.
+static void distance_matrix(std::string aTreeList, std::string aOutput, size_t aNumberOfThreads)
+{
+    const auto sources = read_source_list(aTreeList);
+    if (sources.size() < 2)
+        throw std::runtime_error("at least two trees expected in " + aTreeList);
+
+    std::vector<Tree> trees(sources.size());
+    parallel_for(sources.size(), aNumberOfThreads, [&](size_t aIndex) {
+            TreeImage tree_image;
+            import_tree(trees[aIndex], sources[aIndex], tree_image);
+        });
+    std::vector<const Tree*> tree_pointers;
+    for (const auto& tree: trees)
+        tree_pointers.push_back(&tree);
+    const LeafHashes leaves(tree_pointers);
+    if (leaves.size() < 4)
+        throw std::runtime_error("too few leaves common to all trees: " + std::to_string(leaves.size()));
+
+    std::vector<SplitSet> split_sets(trees.size());
+    parallel_for(trees.size(), aNumberOfThreads, [&](size_t aIndex) {
+            split_sets[aIndex] = SplitSet(tree_splits(trees[aIndex], leaves));
+            trees[aIndex] = Tree();
+        });
+    const DistanceMatrix matrix(split_sets, aNumberOfThreads);
+
+    std::ofstream file;
+    if (aOutput != "-") {
+        file.open(aOutput);
+        if (!file)
+            throw std::runtime_error("cannot write " + aOutput);
+    }
+    std::ostream& output = aOutput == "-" ? std::cout : file;
+    if (aOutput.size() > 5 && aOutput.substr(aOutput.size() - 5) == ".json") {
+        json rf = json::array(), weighted = json::array();
+        for (size_t row = 0; row < matrix.size(); ++row) {
+            json rf_row = json::array(), weighted_row = json::array();
+            for (size_t column = 0; column < matrix.size(); ++column) {
+                rf_row.push_back(matrix(row, column).robinson_foulds);
+                weighted_row.push_back(matrix(row, column).weighted);
+            }
+            rf.push_back(rf_row);
+            weighted.push_back(weighted_row);
+        }
+        output << json{{"trees", sources}, {"common_leaves", leaves.size()}, {"rf", rf}, {"weighted_rf", weighted}}.dump(1) << std::endl;
+    }
+    else {
+        auto write_tsv = [&](std::string aTitle, bool aWeighted) {
+            output << "# " << aTitle << " (common leaves: " << leaves.size() << ")" << std::endl;
+            for (const auto& source: sources)
+                output << '\t' << source;
+            output << std::endl;
+            for (size_t row = 0; row < matrix.size(); ++row) {
+                output << sources[row];
+                for (size_t column = 0; column < matrix.size(); ++column) {
+                    output << '\t';
+                    if (aWeighted)
+                        output << matrix(row, column).weighted;
+                    else
+                        output << matrix(row, column).robinson_foulds;
+                }
+                output << std::endl;
+            }
+        };
+        write_tsv("RF", false);
+        output << std::endl;
+        write_tsv("weighted RF", true);
+    }
+
+} // distance_matrix
+
 // ----------------------------------------------------------------------
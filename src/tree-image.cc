@@ -1,37 +1,325 @@
 #include <iostream>
+#include <fstream>
 #include <cstdio>
 #include <cmath>
 #include <cassert>
 #include <map>
+#include <set>
+#include <algorithm>
+#include <numeric>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <cerrno>
+#include <sys/stat.h>
+
+#ifdef HAVE_CAIRO_SCRIPT
+#include <cairo-script.h>
+#include <cairo-script-interpreter.h>
+#endif
 
 #include "tree-image.hh"
 #include "tree.hh"
 
+// ----------------------------------------------------------------------
+
+  // FNV-1a, stable across runs and platforms, used for cache keys
+static std::string hash_hex(std::string aData)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (auto c: aData) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    char result[17];
+    std::snprintf(result, sizeof(result), "%016llx", static_cast<unsigned long long>(hash));
+    return result;
+
+} // hash_hex
+
 // ----------------------------------------------------------------------
 
 void TreeImage::make_pdf(std::string aFilename, const Tree& aTre, const Coloring& aColoring, int aNumberStrainsThreshold, bool aShowBranchIds, bool aShowSubtreesTopBottom, const Size& aCanvasSize)
 {
     setup(aFilename, aTre, aCanvasSize);
-
-    draw_title();
-    tree().draw(*this, aTre, aColoring, aNumberStrainsThreshold, aShowBranchIds);
-    draw_legend(aColoring);
+    resolve_leaf_colors(aTre, aColoring);
     if (time_series().show())
-        time_series().draw(*this, aTre, aColoring, aShowSubtreesTopBottom);
-    if (clades().show())
-        clades().draw(*this, aTre);
+        time_series().prepare(*this, aTre);
+
+    if (number_of_pages() > 1) {
+        if (!mCacheDirectory.empty())
+            std::cerr << "WARNING: cache directory " << mCacheDirectory << " is not used for multi-page output" << std::endl;
+        draw_pages(aTre, aColoring, aNumberStrainsThreshold, aShowBranchIds, aShowSubtreesTopBottom);
+    }
+    else {
+        draw_panels(aTre, aColoring, aNumberStrainsThreshold, aShowBranchIds, aShowSubtreesTopBottom);
+    }
+    surface().finish();
 
 } // TreeImage::make_pdf
 
 // ----------------------------------------------------------------------
 
+size_t TreeImage::number_of_pages() const
+{
+    if (mSurface.raster())
+        return 1;           // png output is always a single image
+    auto const lines_per_page = tree().lines_per_page(*this);
+    return (tree().number_of_lines() + lines_per_page - 1) / lines_per_page;
+
+} // TreeImage::number_of_pages
+
+// ----------------------------------------------------------------------
+
+  // Title, tree, legend, time series and clades read the same tree and layout and draw into
+  // different regions. Each panel is drawn in its own thread into a recording surface, recordings
+  // are then painted onto the output in the order panels used to be drawn.
+  // If cache directory is set, each panel recording is kept there as a cairo script along with
+  // the hash of everything the panel depends on, the panel is redrawn only if the hash changed.
+void TreeImage::draw_panels(const Tree& aTre, const Coloring& aColoring, int aNumberStrainsThreshold, bool aShowBranchIds, bool aShowSubtreesTopBottom)
+{
+    struct Panel
+    {
+        std::string name;
+        json inputs;            // settings the panel depends on, besides tree, coloring and layout
+        std::function<void(Surface&)> draw;
+    };
+
+    const Viewport whole_canvas({0.0, 0.0}, mSurface.canvas_size());
+    std::vector<Panel> panels;
+    panels.push_back({"title", json{{"title", mTitle}}, [&](Surface& surface) { draw_title(surface); }});
+    panels.push_back({"tree", json{{"tree", tree().dump_to_json()}, {"number_strains_threshold", aNumberStrainsThreshold}, {"show_branch_ids", aShowBranchIds}},
+                      [&](Surface& surface) { tree().draw(*this, surface, aTre, aNumberStrainsThreshold, aShowBranchIds, whole_canvas); }});
+    panels.push_back({"legend", json{{"coloring", mColoringSettings}}, [&](Surface& surface) { draw_legend(surface, aColoring, tree().number_of_lines()); }});
+    if (time_series().show()) {
+        panels.push_back({"time_series", json{{"time_series", time_series().dump_to_json()}, {"show_subtree_top_bottom", aShowSubtreesTopBottom}},
+                          [&](Surface& surface) {
+                              time_series().draw_header(*this, surface);
+                              time_series().draw(*this, surface, aTre, aShowSubtreesTopBottom, whole_canvas);
+                          }});
+    }
+    if (clades().show())
+        panels.push_back({"clades", json{{"clades", clades().dump_to_json()}}, [&](Surface& surface) { clades().draw(*this, surface, aTre, whole_canvas); }});
+
+    std::string common_inputs;
+    if (!mCacheDirectory.empty()) {
+        if (mkdir(mCacheDirectory.c_str(), 0777) != 0 && errno != EEXIST)
+            throw TreeImageError("cannot create cache directory " + mCacheDirectory);
+          // hash of the tree is kept along with mCacheTreeKey (source file and its modification time),
+          // the tree is dumped and hashed only if the source changed (possibly just its _settings)
+        std::string source_key, tree_hash;
+        {
+            std::ifstream tree_key_file(mCacheDirectory + "/tree.key");
+            std::getline(tree_key_file, source_key);
+            std::getline(tree_key_file, tree_hash);
+        }
+        if (mCacheTreeKey.empty() || source_key != mCacheTreeKey || tree_hash.empty()) {
+            tree_hash = hash_hex(::dump_to_json(aTre).dump());
+            if (!mCacheTreeKey.empty())
+                std::ofstream(mCacheDirectory + "/tree.key") << mCacheTreeKey << '\n' << tree_hash << std::endl;
+        }
+        common_inputs = json{{"tree", tree_hash}, {"coloring", aColoring.id()}, {"layout", panel_layout()}}.dump();
+    }
+
+    std::vector<std::unique_ptr<Surface>> recordings(panels.size());
+    std::vector<std::exception_ptr> errors(panels.size());
+    std::vector<char> from_cache(panels.size(), 0); // not vector<bool>, elements are set from different threads
+    auto draw_panel = [&](size_t panel_no) {
+        try {
+            const Panel& panel = panels[panel_no];
+            std::unique_ptr<Surface> recording(new Surface());
+            recording->setup_recording(mSurface.canvas_size());
+            if (mCacheDirectory.empty()) {
+                panel.draw(*recording);
+            }
+            else {
+                const std::string prefix = mCacheDirectory + "/" + panel.name;
+                const std::string key = hash_hex(common_inputs + panel.inputs.dump());
+                std::string cached_key;
+                std::getline(std::ifstream(prefix + ".key"), cached_key);
+                if (cached_key == key) {
+                    recording->load_recording(prefix + ".cairo-script");
+                    from_cache[panel_no] = 1;
+                }
+                else {
+                    panel.draw(*recording);
+                    std::remove((prefix + ".key").c_str()); // old key must not match partially written script
+                    recording->save_recording(prefix + ".cairo-script");
+                    std::ofstream(prefix + ".key") << key << std::endl;
+                }
+            }
+            recording->flush_lines();
+            recordings[panel_no] = std::move(recording);
+        }
+        catch (...) {
+            errors[panel_no] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t panel_no = 1; panel_no < panels.size(); ++panel_no)
+        threads.emplace_back(draw_panel, panel_no);
+    draw_panel(0);
+    for (auto& thread: threads)
+        thread.join();
+    for (const auto& error: errors) {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    for (const auto& recording: recordings) {
+        mSurface.paint(*recording);
+        mSurface.add_statistics(*recording);
+    }
+
+    if (!mCacheDirectory.empty()) {
+        std::cout << "Panels:";
+        for (size_t panel_no = 0; panel_no < panels.size(); ++panel_no)
+            std::cout << ' ' << panels[panel_no].name << (from_cache[panel_no] ? " (cached)" : " (redrawn)");
+        std::cout << std::endl;
+    }
+
+} // TreeImage::draw_panels
+
+// ----------------------------------------------------------------------
+
+  // Coloring is evaluated once per leaf, in parallel chunks, drawing passes (labels,
+  // time series) read the resulting table indexed by line_no.
+void TreeImage::resolve_leaf_colors(const Tree& aTre, const Coloring& aColoring)
+{
+    std::vector<const Node*> leaves(tree().number_of_lines(), nullptr);
+    iterate<const Node&>(aTre, [&leaves](const Node& aNode) { leaves[aNode.line_no] = &aNode; });
+    mLeafColors.assign(leaves.size(), Color(0));
+
+    constexpr size_t chunk_size = 4096;
+    const size_t number_of_chunks = (leaves.size() + chunk_size - 1) / chunk_size;
+    std::atomic<size_t> next_chunk(0);
+    std::exception_ptr error;
+    std::mutex error_access;
+    auto resolve_chunks = [&]() {
+        try {
+            for (size_t chunk = next_chunk++; chunk < number_of_chunks; chunk = next_chunk++) {
+                const size_t begin = chunk * chunk_size;
+                aColoring.resolve(leaves.data() + begin, std::min(chunk_size, leaves.size() - begin), mLeafColors.data() + begin);
+            }
+        }
+        catch (...) {
+            std::unique_lock<std::mutex> lock(error_access);
+            error = std::current_exception();
+        }
+    };
+    std::vector<std::thread> threads;
+    const size_t number_of_threads = std::min(number_of_chunks, static_cast<size_t>(std::max(1U, std::thread::hardware_concurrency())));
+    for (size_t thread_no = 1; thread_no < number_of_threads; ++thread_no)
+        threads.emplace_back(resolve_chunks);
+    resolve_chunks();
+    for (auto& thread: threads)
+        thread.join();
+    if (error)
+        std::rethrow_exception(error);
+
+} // TreeImage::resolve_leaf_colors
+
+// ----------------------------------------------------------------------
+
+  // Positions and sizes panels use to draw, changing settings of one panel may move other panels.
+json TreeImage::panel_layout() const
+{
+    return json {
+        {"canvas", {mSurface.canvas_size().width, mSurface.canvas_size().height}},
+        {"viewport", {viewport().origin.x, viewport().origin.y, viewport().size.width, viewport().size.height}},
+        {"tree", {tree().origin().x, tree().origin().y, tree().width(), tree().vertical_step(), tree().number_of_lines()}},
+        {"time_series", {time_series().origin().x, time_series().origin().y, time_series().width()}},
+        {"clades", {clades().origin().x, clades().origin().y, clades().width()}},
+    };
+
+} // TreeImage::panel_layout
+
+// ----------------------------------------------------------------------
+
+  // Leaf lines are split across pages, each page shows the same horizontal layout (tree, time
+  // series, clades) shifted vertically and clipped, title and month labels are repeated on each page.
+  // Pages are drawn in parallel into recording surfaces which are then painted in order onto the pdf.
+void TreeImage::draw_pages(const Tree& aTre, const Coloring& aColoring, int aNumberStrainsThreshold, bool aShowBranchIds, bool aShowSubtreesTopBottom)
+{
+    const size_t number_of_pages = this->number_of_pages();
+    const double vertical_step = tree().vertical_step();
+    const double page_height = vertical_step * tree().lines_per_page(*this);
+      // page boundaries are half step between leaf lines
+    const Viewport clip({0.0, viewport().origin.y + vertical_step * 0.5}, Size(mSurface.canvas_size().width, page_height));
+    std::cout << "Pages: " << number_of_pages << std::endl;
+
+    std::vector<std::unique_ptr<Surface>> pages(number_of_pages);
+    std::atomic<size_t> next_page(0);
+    std::exception_ptr error;
+    std::mutex error_access;
+    auto draw_page = [&]() {
+        for (size_t page_no = next_page++; page_no < number_of_pages; page_no = next_page++) {
+            try {
+                std::unique_ptr<Surface> page(new Surface());
+                page->setup_recording(mSurface.canvas_size());
+                draw_title(*page);
+                if (time_series().show())
+                    time_series().draw_header(*this, *page);
+                page->push_clip(clip, {0.0, - page_height * page_no});
+                  // part of the drawing shown on this page, nodes outside are not visited
+                const Viewport visible({clip.origin.x, clip.origin.y + page_height * page_no}, clip.size);
+                tree().draw(*this, *page, aTre, aNumberStrainsThreshold, aShowBranchIds, visible);
+                if (time_series().show())
+                    time_series().draw(*this, *page, aTre, aShowSubtreesTopBottom, visible);
+                if (clades().show())
+                    clades().draw(*this, *page, aTre, visible);
+                page->pop_clip();
+                  // once, on the last page, at the bottom of the tree area, not clipped
+                if (page_no == (number_of_pages - 1))
+                    draw_legend(*page, aColoring, tree().lines_per_page(*this));
+                pages[page_no] = std::move(page);
+            }
+            catch (...) {
+                std::unique_lock<std::mutex> lock(error_access);
+                error = std::current_exception();
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    const size_t number_of_threads = std::min(number_of_pages, static_cast<size_t>(std::max(1U, std::thread::hardware_concurrency())));
+    for (size_t thread_no = 1; thread_no < number_of_threads; ++thread_no)
+        threads.emplace_back(draw_page);
+    draw_page();
+    for (auto& thread: threads)
+        thread.join();
+    if (error)
+        std::rethrow_exception(error);
+
+    for (const auto& page: pages) {
+        mSurface.paint(*page);
+        mSurface.add_statistics(*page);
+        mSurface.show_page();
+    }
+
+} // TreeImage::draw_pages
+
+// ----------------------------------------------------------------------
+
 void TreeImage::setup(std::string aFilename, const Tree& aTre, const Size& aCanvasSize)
 {
-    mViewport = Viewport(Location(0, 0) + aCanvasSize * mBorder * 0.5, aCanvasSize * (1.0 - mBorder * 0.5) - Location(10.0, aCanvasSize.height * mBorder * 0.5));
+    auto make_viewport = [this](const Size& aSize) { return Viewport(Location(0, 0) + aSize * mBorder * 0.5, aSize * (1.0 - mBorder * 0.5) - Location(10.0, aSize.height * mBorder * 0.5)); };
+    mViewport = make_viewport(aCanvasSize);
 
-    mSurface.setup(aFilename, aCanvasSize);
+    mSurface.setup(aFilename, aCanvasSize, mRasterScale);
       // mSurface.test();
     tree().setup(*this, aTre);
+    if (mSurface.raster()) {
+          // png is a single image (no pages), if min_font_size made lines not fit, canvas is made taller
+        const double tree_height = tree().vertical_step() * (tree().number_of_lines() + 2);
+        if (tree_height > (viewport().size.height + 0.5)) {
+            const Size canvas_size(aCanvasSize.width, tree_height / (1.0 - mBorder));
+            std::cerr << "WARNING: canvas height increased to " << canvas_size.height << " to fit " << tree().number_of_lines() << " lines with min_font_size" << std::endl;
+            mViewport = make_viewport(canvas_size);
+            mSurface.resize_raster(canvas_size);
+            tree().setup(*this, aTre);
+        }
+    }
     time_series().setup(*this, aTre);
     clades().setup(*this, aTre);
 
@@ -87,25 +375,25 @@ void TreeImage::setup(std::string aFilename, const Tree& aTre, const Size& aCanv
 
 // ----------------------------------------------------------------------
 
-void TreeImage::draw_title()
+void TreeImage::draw_title(Surface& surface)
 {
     if (mTitle.show and !mTitle.label.empty()) {
-        surface().text({mTitle.label_x, mTitle.label_y}, mTitle.label, mTitle.label_color, mTitle.font_size);
+        surface.text({mTitle.label_x, mTitle.label_y}, mTitle.label, mTitle.label_color, mTitle.font_size);
     }
 
 } // TreeImage::draw_title
 
 // ----------------------------------------------------------------------
 
-void TreeImage::draw_legend(const Coloring& aColoring)
+void TreeImage::draw_legend(Surface& surface, const Coloring& aColoring, size_t aNumberOfLines)
 {
-    aColoring.draw_legend(surface(), {tree().origin().x, tree().origin().y + tree().vertical_step() * tree().number_of_lines()}, mColoringSettings);
+    aColoring.draw_legend(surface, {tree().origin().x, tree().origin().y + tree().vertical_step() * aNumberOfLines}, mColoringSettings);
 
 } // TreeImage::draw_legend
 
 // ----------------------------------------------------------------------
 
-class ColoringByContinent : public Coloring
+class ColoringByContinent final : public Coloring
 {
  public:
     virtual inline Color operator()(const Node& aNode) const
@@ -113,6 +401,18 @@ class ColoringByContinent : public Coloring
             return colors().continent(aNode.continent);
         }
 
+    virtual inline void resolve(const Node* const* aNodes, size_t aNumber, Color* aResult) const
+        {
+              // just a few continents, json lookup once per continent in the batch
+            std::map<std::string, Color> continent_color;
+            for (size_t index = 0; index < aNumber; ++index) {
+                auto found = continent_color.find(aNodes[index]->continent);
+                if (found == continent_color.end())
+                    found = continent_color.emplace(aNodes[index]->continent, ColoringByContinent::operator()(*aNodes[index])).first;
+                aResult[index] = found->second;
+            }
+        }
+
     virtual inline void draw_legend(Surface& aSurface, const Location& aLocation, const ColoringSettings& aSettings) const
         {
             if (aSettings.legend_show) {
@@ -126,6 +426,8 @@ class ColoringByContinent : public Coloring
                 }
             }
         }
+
+    virtual inline std::string id() const { return "continent"; }
 };
 
 Coloring* TreeImage::coloring_by_continent()
@@ -136,7 +438,7 @@ Coloring* TreeImage::coloring_by_continent()
 
 // ----------------------------------------------------------------------
 
-class ColoringByPos : public Coloring
+class ColoringByPos final : public Coloring
 {
  public:
     inline ColoringByPos(std::string aPos, const Tree& aTree)
@@ -155,6 +457,12 @@ class ColoringByPos : public Coloring
             return c;
         }
 
+    virtual inline void resolve(const Node* const* aNodes, size_t aNumber, Color* aResult) const
+        {
+            for (size_t index = 0; index < aNumber; ++index)
+                aResult[index] = ColoringByPos::operator()(*aNodes[index]);
+        }
+
 
     virtual inline void draw_legend(Surface& aSurface, const Location& aLocation, const ColoringSettings& aSettings) const
         {
@@ -169,6 +477,8 @@ class ColoringByPos : public Coloring
             }
         }
 
+    virtual inline std::string id() const { return "pos:" + mPos; }
+
  private:
     std::string mPos;
     std::string mAllAA;
@@ -182,6 +492,21 @@ Coloring* TreeImage::coloring_by_pos(std::string aPos, const Tree& aTree)
 
 // ----------------------------------------------------------------------
 
+Coloring* TreeImage::coloring_by_name(std::string aName, const Tree& aTree)
+{
+    if (aName.empty() || aName == "black")
+        return new ColoringBlack();
+    else if (aName == "continents")
+        return coloring_by_continent();
+    else if (aName.substr(0, 4) == "pos:")
+        return coloring_by_pos(aName.substr(4), aTree);
+    else
+        throw TreeImageError("unrecognized coloring: " + aName);
+
+} // TreeImage::coloring_by_name
+
+// ----------------------------------------------------------------------
+
 json TreeImage::dump_to_json() const
 {
     json j = {
@@ -214,11 +539,34 @@ void TreeImage::load_from_json(const json& j)
 
 // ----------------------------------------------------------------------
 
-void Surface::setup(std::string aFilename, const Size& aCanvasSize)
+Surface::~Surface()
 {
-    auto surface = cairo_pdf_surface_create(aFilename.c_str(), aCanvasSize.width, aCanvasSize.height);
+    for (auto& entry: mScaledFonts)
+        cairo_scaled_font_destroy(entry.second);
+    for (auto& entry: mFontFaces)
+        cairo_font_face_destroy(entry.second);
+    if (mContext != nullptr)
+        cairo_destroy(mContext);
+
+} // Surface::~Surface
+
+// ----------------------------------------------------------------------
+
+void Surface::setup(std::string aFilename, const Size& aCanvasSize, double aRasterScale)
+{
+    cairo_surface_t* surface = nullptr;
+    if (aFilename.size() > 4 && aFilename.substr(aFilename.size() - 4) == ".png") {
+          // layout and drawing are done once into a recording surface, finish() rasterizes it in tiles
+        const cairo_rectangle_t extents = {0.0, 0.0, aCanvasSize.width, aCanvasSize.height};
+        surface = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, &extents);
+        mRasterFilename = aFilename;
+        mRasterScale = aRasterScale;
+    }
+    else {
+        surface = cairo_pdf_surface_create(aFilename.c_str(), aCanvasSize.width, aCanvasSize.height);
+    }
     if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
-        throw TreeImageError("cannot create pdf surface");
+        throw TreeImageError("cannot create surface for " + aFilename);
     mContext = cairo_create(surface);
     cairo_surface_destroy(surface);
     if (cairo_status(mContext) != CAIRO_STATUS_SUCCESS)
@@ -230,6 +578,245 @@ void Surface::setup(std::string aFilename, const Size& aCanvasSize)
 
 // ----------------------------------------------------------------------
 
+void Surface::setup_recording(const Size& aCanvasSize)
+{
+    const cairo_rectangle_t extents = {0.0, 0.0, aCanvasSize.width, aCanvasSize.height};
+    auto surface = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, &extents);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+        throw TreeImageError("cannot create recording surface");
+    mContext = cairo_create(surface);
+    cairo_surface_destroy(surface);
+    if (cairo_status(mContext) != CAIRO_STATUS_SUCCESS)
+        throw TreeImageError("cannot create mContext");
+
+    mCanvasSize = aCanvasSize;
+
+} // Surface::setup_recording
+
+// ----------------------------------------------------------------------
+
+void Surface::resize_raster(const Size& aCanvasSize)
+{
+    if (!raster())
+        throw TreeImageError("Surface::resize_raster: not a raster output");
+    const cairo_rectangle_t extents = {0.0, 0.0, aCanvasSize.width, aCanvasSize.height};
+    auto surface = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, &extents);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+        throw TreeImageError("cannot create surface for " + mRasterFilename);
+    cairo_destroy(mContext);
+    mContext = cairo_create(surface);
+    cairo_surface_destroy(surface);
+    if (cairo_status(mContext) != CAIRO_STATUS_SUCCESS)
+        throw TreeImageError("cannot create mContext");
+
+    mCanvasSize = aCanvasSize;
+
+} // Surface::resize_raster
+
+// ----------------------------------------------------------------------
+
+void Surface::push_clip(const Viewport& aClip, const Location& aOffset)
+{
+    flush_lines();
+    cairo_save(mContext);
+    cairo_rectangle(mContext, aClip.origin.x, aClip.origin.y, aClip.size.width, aClip.size.height);
+    cairo_clip(mContext);
+    cairo_translate(mContext, aOffset.x, aOffset.y);
+
+} // Surface::push_clip
+
+// ----------------------------------------------------------------------
+
+void Surface::pop_clip()
+{
+    flush_lines();
+    cairo_restore(mContext);
+
+} // Surface::pop_clip
+
+// ----------------------------------------------------------------------
+
+void Surface::paint(const Surface& aRecording)
+{
+    cairo_save(mContext);
+    cairo_set_source_surface(mContext, cairo_get_target(aRecording.mContext), 0.0, 0.0);
+    cairo_paint(mContext);
+    cairo_restore(mContext);
+
+} // Surface::paint
+
+// ----------------------------------------------------------------------
+
+void Surface::save_recording(std::string aFilename)
+{
+#ifdef HAVE_CAIRO_SCRIPT
+    flush_lines();
+    auto device = cairo_script_create(aFilename.c_str());
+    auto status = cairo_device_status(device);
+    if (status == CAIRO_STATUS_SUCCESS)
+        status = cairo_script_from_recording_surface(device, cairo_get_target(mContext));
+    cairo_device_finish(device);
+    cairo_device_destroy(device);
+    if (status != CAIRO_STATUS_SUCCESS)
+        throw TreeImageError("cannot write " + aFilename + ": " + cairo_status_to_string(status));
+#else
+    throw TreeImageError("cannot write " + aFilename + ": cairo script support is not compiled in");
+#endif
+
+} // Surface::save_recording
+
+// ----------------------------------------------------------------------
+
+#ifdef HAVE_CAIRO_SCRIPT
+  // script creates its surface via hook, drawing goes to aTarget
+static cairo_status_t interpret_script(cairo_surface_t* aTarget, std::function<cairo_status_t(csi_t*)> aRun)
+{
+    csi_hooks_t hooks = {};
+    hooks.closure = aTarget;
+    hooks.surface_create = [](void* closure, cairo_content_t, double, double, long) -> cairo_surface_t* { return cairo_surface_reference(static_cast<cairo_surface_t*>(closure)); };
+    auto interpreter = cairo_script_interpreter_create();
+    cairo_script_interpreter_install_hooks(interpreter, &hooks);
+    auto status = aRun(interpreter);
+    auto const finish_status = cairo_script_interpreter_finish(interpreter);
+    if (status == CAIRO_STATUS_SUCCESS)
+        status = finish_status;
+    cairo_script_interpreter_destroy(interpreter);
+    return status;
+
+} // interpret_script
+#endif
+
+// ----------------------------------------------------------------------
+
+void Surface::load_recording(std::string aFilename)
+{
+#ifdef HAVE_CAIRO_SCRIPT
+    flush_lines();
+    auto const status = interpret_script(cairo_get_target(mContext), [&aFilename](csi_t* aInterpreter) { return cairo_script_interpreter_run(aInterpreter, aFilename.c_str()); });
+    if (status != CAIRO_STATUS_SUCCESS)
+        throw TreeImageError("cannot replay " + aFilename + ": " + cairo_status_to_string(status));
+#else
+    throw TreeImageError("cannot read " + aFilename + ": cairo script support is not compiled in");
+#endif
+
+} // Surface::load_recording
+
+// ----------------------------------------------------------------------
+
+void Surface::show_page()
+{
+    flush_lines();
+    cairo_show_page(mContext);
+
+} // Surface::show_page
+
+// ----------------------------------------------------------------------
+
+void Surface::finish()
+{
+    flush_lines();
+    if (!mRasterFilename.empty())
+        write_png_tiled();
+
+} // Surface::finish
+
+// ----------------------------------------------------------------------
+
+  // Each tile is rendered directly into the region of the final image, tiles do not overlap.
+  // Replay of a cairo recording surface is not thread safe (it updates the index of recorded
+  // operations and attaches snapshots to the source), so each thread replays its own copy of the
+  // recording: the recording is saved once as a cairo script in memory and every thread
+  // interprets it into a private recording surface. Without cairo script support tiles are
+  // rendered in one thread. Replays are clipped to the tile, only operations intersecting it are drawn.
+void Surface::write_png_tiled()
+{
+    constexpr int tile_size = 1024;
+    const int width = static_cast<int>(std::ceil(mCanvasSize.width * mRasterScale));
+    const int height = static_cast<int>(std::ceil(mCanvasSize.height * mRasterScale));
+    auto image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+    if (cairo_surface_status(image) != CAIRO_STATUS_SUCCESS)
+        throw TreeImageError("cannot create image surface " + std::to_string(width) + "x" + std::to_string(height));
+    cairo_surface_flush(image);
+    unsigned char* const data = cairo_image_surface_get_data(image);
+    const int stride = cairo_image_surface_get_stride(image);
+    cairo_surface_t* recording = cairo_get_target(mContext);
+    cairo_surface_flush(recording);
+
+    const int tiles_x = (width + tile_size - 1) / tile_size;
+    const int tiles_y = (height + tile_size - 1) / tile_size;
+    const int number_of_tiles = tiles_x * tiles_y;
+    int number_of_threads = std::min(number_of_tiles, static_cast<int>(std::max(1U, std::thread::hardware_concurrency())));
+#ifdef HAVE_CAIRO_SCRIPT
+    std::string script;
+    if (number_of_threads > 1) {
+        auto device = cairo_script_create_for_stream([](void* closure, const unsigned char* aData, unsigned int aLength) -> cairo_status_t { static_cast<std::string*>(closure)->append(reinterpret_cast<const char*>(aData), aLength); return CAIRO_STATUS_SUCCESS; }, &script);
+        auto status = cairo_device_status(device);
+        if (status == CAIRO_STATUS_SUCCESS)
+            status = cairo_script_from_recording_surface(device, recording);
+        cairo_device_finish(device);
+        cairo_device_destroy(device);
+        if (status != CAIRO_STATUS_SUCCESS)
+            number_of_threads = 1; // cannot copy recording, replay it in this thread only
+    }
+#else
+    number_of_threads = 1;
+#endif
+
+    std::atomic<int> next_tile(0);
+    std::atomic<bool> failed(false);
+    auto render_tiles = [&](bool aOwnCopy) {
+        cairo_surface_t* source = recording;
+#ifdef HAVE_CAIRO_SCRIPT
+        if (aOwnCopy) {
+            const cairo_rectangle_t extents = {0.0, 0.0, mCanvasSize.width, mCanvasSize.height};
+            source = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, &extents);
+            if (interpret_script(source, [&script](csi_t* aInterpreter) { return cairo_script_interpreter_feed_string(aInterpreter, script.data(), static_cast<int>(script.size())); }) != CAIRO_STATUS_SUCCESS)
+                failed = true;
+            cairo_surface_flush(source);
+        }
+#else
+        static_cast<void>(aOwnCopy);
+#endif
+        for (int tile = next_tile++; !failed && tile < number_of_tiles; tile = next_tile++) {
+            const int left = (tile % tiles_x) * tile_size, top = (tile / tiles_x) * tile_size;
+            const int tile_width = std::min(tile_size, width - left), tile_height = std::min(tile_size, height - top);
+            auto tile_surface = cairo_image_surface_create_for_data(data + top * stride + left * 4, CAIRO_FORMAT_ARGB32, tile_width, tile_height, stride);
+            auto context = cairo_create(tile_surface);
+            cairo_rectangle(context, 0.0, 0.0, tile_width, tile_height);
+            cairo_clip(context);
+            cairo_set_source_rgb(context, 1.0, 1.0, 1.0);
+            cairo_paint(context);
+            cairo_translate(context, -left, -top);
+            cairo_scale(context, mRasterScale, mRasterScale);
+            cairo_set_source_surface(context, source, 0.0, 0.0);
+            cairo_paint(context);
+            if (cairo_status(context) != CAIRO_STATUS_SUCCESS)
+                failed = true;
+            cairo_destroy(context);
+            cairo_surface_finish(tile_surface);
+            cairo_surface_destroy(tile_surface);
+        }
+        if (source != recording)
+            cairo_surface_destroy(source);
+    };
+    std::vector<std::thread> threads;
+    for (int thread_no = 1; thread_no < number_of_threads; ++thread_no)
+        threads.emplace_back(render_tiles, true);
+    render_tiles(false);    // the only thread replaying the original recording
+    for (auto& thread: threads)
+        thread.join();
+
+    cairo_surface_mark_dirty(image);
+    const auto status = failed ? CAIRO_STATUS_NO_MEMORY : cairo_surface_write_to_png(image, mRasterFilename.c_str());
+    cairo_surface_destroy(image);
+    if (status != CAIRO_STATUS_SUCCESS)
+        throw TreeImageError("cannot write " + mRasterFilename);
+    std::cout << "Raster image " << width << "x" << height << " in " << number_of_tiles << " tiles written to " << mRasterFilename << std::endl;
+
+} // Surface::write_png_tiled
+
+// ----------------------------------------------------------------------
+
 void Surface::line(const Location& a, const Location& b, const Color& aColor, double aWidth, cairo_line_cap_t aLineCap)
 {
     cairo_save(mContext);
@@ -245,6 +832,40 @@ void Surface::line(const Location& a, const Location& b, const Color& aColor, do
 
 // ----------------------------------------------------------------------
 
+void Surface::line_batched(const Location& a, const Location& b, const Color& aColor, double aWidth, cairo_line_cap_t aLineCap)
+{
+    auto const key = std::make_tuple((aColor.alphaI() << 24) | aColor.rgbI(), aWidth, static_cast<int>(aLineCap));
+    auto batch = mLineBatches.find(key);
+    if (batch == mLineBatches.end())
+        batch = mLineBatches.emplace(key, LineBatch{aColor, aWidth, aLineCap, {}}).first;
+    batch->second.points.push_back(a);
+    batch->second.points.push_back(b);
+
+} // Surface::line_batched
+
+// ----------------------------------------------------------------------
+
+void Surface::flush_lines()
+{
+    for (const auto& entry: mLineBatches) {
+        const LineBatch& batch = entry.second;
+        cairo_save(mContext);
+        cairo_set_line_width(mContext, batch.width);
+        batch.color.set_source_rgba(mContext);
+        cairo_set_line_cap(mContext, batch.line_cap);
+        for (auto point = batch.points.begin(); point != batch.points.end(); point += 2) {
+            cairo_move_to(mContext, point->x, point->y);
+            cairo_line_to(mContext, (point + 1)->x, (point + 1)->y);
+        }
+        cairo_stroke(mContext);
+        cairo_restore(mContext);
+    }
+    mLineBatches.clear();
+
+} // Surface::flush_lines
+
+// ----------------------------------------------------------------------
+
 void Surface::double_arrow(const Location& a, const Location& b, const Color& aColor, double aLineWidth, double aArrowWidth)
 {
     const bool x_eq = std::fabs(b.x - a.x) < 1e-10;
@@ -260,6 +881,33 @@ void Surface::double_arrow(const Location& a, const Location& b, const Color& aC
 
 // ----------------------------------------------------------------------
 
+void Surface::triangle(const Location& a, const Location& b, const Location& c, const Color& aColor)
+{
+    cairo_save(mContext);
+    aColor.set_source_rgba(mContext);
+    cairo_move_to(mContext, a.x, a.y);
+    cairo_line_to(mContext, b.x, b.y);
+    cairo_line_to(mContext, c.x, c.y);
+    cairo_close_path(mContext);
+    cairo_fill(mContext);
+    cairo_restore(mContext);
+
+} // Surface::triangle
+
+// ----------------------------------------------------------------------
+
+void Surface::rectangle(const Location& a, const Size& s, const Color& aColor)
+{
+    cairo_save(mContext);
+    aColor.set_source_rgba(mContext);
+    cairo_rectangle(mContext, a.x, a.y, s.width, s.height);
+    cairo_fill(mContext);
+    cairo_restore(mContext);
+
+} // Surface::rectangle
+
+// ----------------------------------------------------------------------
+
 Location Surface::arrow_head(const Location& a, double angle, double sign, const Color& aColor, double aArrowWidth)
 {
     constexpr double ARROW_WIDTH_TO_LENGTH_RATIO = 2.0;
@@ -288,9 +936,10 @@ Location Surface::arrow_head(const Location& a, double angle, double sign, const
 void Surface::text(const Location& a, std::string aText, const Color& aColor, double aSize, FontStyle aFontStyle, cairo_font_slant_t aSlant, cairo_font_weight_t aWeight, double aRotation)
 {
     cairo_save(mContext);
-    context_prepare_for_text(aSize, aFontStyle, aSlant, aWeight);
     cairo_move_to(mContext, a.x, a.y);
-    cairo_rotate(mContext, aRotation);
+    if (aRotation != 0.0)
+        cairo_rotate(mContext, aRotation);
+    context_prepare_for_text(aSize, aFontStyle, aSlant, aWeight); // after rotation, it would discard the font set before
     aColor.set_source_rgba(mContext);
     cairo_show_text(mContext, aText.c_str());
     cairo_restore(mContext);
@@ -301,35 +950,153 @@ void Surface::text(const Location& a, std::string aText, const Color& aColor, do
 
 Size Surface::text_size(std::string aText, double aSize, FontStyle aFontStyle, cairo_font_slant_t aSlant, cairo_font_weight_t aWeight, double* x_bearing)
 {
-    cairo_save(mContext);
-    context_prepare_for_text(aSize, aFontStyle, aSlant, aWeight);
-    cairo_text_extents_t text_extents;
-    cairo_text_extents(mContext, aText.c_str(), &text_extents);
-    cairo_restore(mContext);
+    TextExtentsKey key{aText, aFontStyle, aSlant, aWeight};
+    auto cached = mTextExtentsCache.find(key);
+    if (cached == mTextExtentsCache.end()) {
+        cairo_text_extents_t text_extents;
+        cairo_scaled_font_text_extents(scaled_font(1.0, aFontStyle, aSlant, aWeight), aText.c_str(), &text_extents);
+        cached = mTextExtentsCache.emplace(std::move(key), TextExtents{text_extents.x_bearing, text_extents.y_bearing, text_extents.x_advance}).first;
+        ++mTextExtentsMisses;
+    }
+    else {
+        ++mTextExtentsHits;
+    }
     if (x_bearing != nullptr)
-        *x_bearing = text_extents.x_bearing;
-    return {text_extents.x_advance, - text_extents.y_bearing};
+        *x_bearing = cached->second.x_bearing * aSize;
+    return {cached->second.x_advance * aSize, - cached->second.y_bearing * aSize};
 
 } // Surface::text_size
 
 // ----------------------------------------------------------------------
 
-void Surface::context_prepare_for_text(double aSize, FontStyle aFontStyle, cairo_font_slant_t aSlant, cairo_font_weight_t aWeight)
+GlyphRun Surface::glyph_run(std::string aText, FontStyle aFontStyle, cairo_font_slant_t aSlant, cairo_font_weight_t aWeight)
+{
+    GlyphRun run;
+    if (!aText.empty()) {
+        auto font = scaled_font(1.0, aFontStyle, aSlant, aWeight);
+        cairo_glyph_t* glyphs = nullptr;
+        int num_glyphs = 0;
+        if (cairo_scaled_font_text_to_glyphs(font, 0.0, 0.0, aText.c_str(), static_cast<int>(aText.size()), &glyphs, &num_glyphs, nullptr, nullptr, nullptr) != CAIRO_STATUS_SUCCESS)
+            throw TreeImageError("cannot convert text to glyphs: " + aText);
+        run.mGlyphs.assign(glyphs, glyphs + num_glyphs);
+        cairo_glyph_free(glyphs);
+        cairo_text_extents_t text_extents;
+        cairo_scaled_font_glyph_extents(font, run.mGlyphs.data(), num_glyphs, &text_extents);
+        run.mXBearing = text_extents.x_bearing;
+        run.mYBearing = text_extents.y_bearing;
+        run.mXAdvance = text_extents.x_advance;
+    }
+    return run;
+
+} // Surface::glyph_run
+
+// ----------------------------------------------------------------------
+
+void Surface::text(const Location& a, const GlyphRun& aRun, const Color& aColor, double aSize, FontStyle aFontStyle, cairo_font_slant_t aSlant, cairo_font_weight_t aWeight)
 {
-    switch (aFontStyle) {
-      case FONT_MONOSPACE:
-          cairo_select_font_face(mContext, "monospace", aSlant, aWeight);
-          break;
-      case FONT_DEFAULT:
-          cairo_select_font_face(mContext, "sans-serif", aSlant, aWeight);
-          break;
+    if (!aRun.empty()) {
+          // font of the drawn size and glyphs positioned in user space, no transformation after
+          // cairo_set_scaled_font, otherwise cairo makes its own scaled font for the new matrix
+        mGlyphBuffer.resize(aRun.mGlyphs.size());
+        std::transform(aRun.mGlyphs.begin(), aRun.mGlyphs.end(), mGlyphBuffer.begin(), [&](cairo_glyph_t aGlyph) { aGlyph.x = a.x + aGlyph.x * aSize; aGlyph.y = a.y + aGlyph.y * aSize; return aGlyph; });
+        cairo_save(mContext);
+        cairo_set_scaled_font(mContext, scaled_font(aSize, aFontStyle, aSlant, aWeight));
+        aColor.set_source_rgba(mContext);
+        cairo_show_glyphs(mContext, mGlyphBuffer.data(), static_cast<int>(mGlyphBuffer.size()));
+        cairo_restore(mContext);
     }
-    cairo_set_font_size(mContext, aSize);
+
+} // Surface::text
+
+// ----------------------------------------------------------------------
+
+void Surface::print_statistics(std::ostream& out) const
+{
+    auto const total = mTextExtentsHits + mTextExtentsMisses;
+    out << "Text extents cache: " << total << " lookups, " << mTextExtentsHits << " hits";
+    if (total)
+        out << " (" << (100.0 * mTextExtentsHits / total) << "%)";
+    out << ", " << mTextExtentsMisses << " entries" << std::endl;
+    out << "Font cache: " << (mScaledFontHits + mScaledFontMisses) << " scaled font lookups, " << mScaledFontMisses << " created, " << mFontFacesCreated << " font faces" << std::endl;
+
+} // Surface::print_statistics
+
+// ----------------------------------------------------------------------
+
+void Surface::add_statistics(const Surface& aSource)
+{
+    mTextExtentsHits += aSource.mTextExtentsHits;
+    mTextExtentsMisses += aSource.mTextExtentsMisses;
+    mScaledFontHits += aSource.mScaledFontHits;
+    mScaledFontMisses += aSource.mScaledFontMisses;
+    mFontFacesCreated += aSource.mFontFacesCreated;
+
+} // Surface::add_statistics
+
+// ----------------------------------------------------------------------
+
+void Surface::context_prepare_for_text(double aSize, FontStyle aFontStyle, cairo_font_slant_t aSlant, cairo_font_weight_t aWeight)
+{
+    cairo_set_scaled_font(mContext, scaled_font(aSize, aFontStyle, aSlant, aWeight));
 
 } // Surface::context_prepare_for_text
 
 // ----------------------------------------------------------------------
 
+cairo_font_face_t* Surface::font_face(FontStyle aFontStyle, cairo_font_slant_t aSlant, cairo_font_weight_t aWeight)
+{
+    auto const key = std::make_tuple(static_cast<int>(aFontStyle), static_cast<int>(aSlant), static_cast<int>(aWeight));
+    auto found = mFontFaces.find(key);
+    if (found == mFontFaces.end()) {
+        const char* family = nullptr;
+        switch (aFontStyle) {
+          case FONT_MONOSPACE:
+              family = "monospace";
+              break;
+          case FONT_DEFAULT:
+              family = "sans-serif";
+              break;
+        }
+        auto face = cairo_toy_font_face_create(family, aSlant, aWeight);
+        if (cairo_font_face_status(face) != CAIRO_STATUS_SUCCESS)
+            throw TreeImageError(std::string("cannot create font face ") + family);
+        found = mFontFaces.emplace(key, face).first;
+        ++mFontFacesCreated;
+    }
+    return found->second;
+
+} // Surface::font_face
+
+// ----------------------------------------------------------------------
+
+cairo_scaled_font_t* Surface::scaled_font(double aSize, FontStyle aFontStyle, cairo_font_slant_t aSlant, cairo_font_weight_t aWeight)
+{
+    auto const key = std::make_tuple(static_cast<int>(aFontStyle), static_cast<int>(aSlant), static_cast<int>(aWeight), aSize);
+    auto found = mScaledFonts.find(key);
+    if (found == mScaledFonts.end()) {
+        cairo_matrix_t font_matrix, ctm;
+        cairo_matrix_init_scale(&font_matrix, aSize, aSize);
+        cairo_matrix_init_identity(&ctm);
+        auto options = cairo_font_options_create();
+        cairo_surface_get_font_options(cairo_get_target(mContext), options);
+          // metrics must scale linearly with size, text extents cache relies on that
+        cairo_font_options_set_hint_metrics(options, CAIRO_HINT_METRICS_OFF);
+        auto font = cairo_scaled_font_create(font_face(aFontStyle, aSlant, aWeight), &font_matrix, &ctm, options);
+        cairo_font_options_destroy(options);
+        if (cairo_scaled_font_status(font) != CAIRO_STATUS_SUCCESS)
+            throw TreeImageError("cannot create scaled font");
+        found = mScaledFonts.emplace(key, font).first;
+        ++mScaledFontMisses;
+    }
+    else {
+        ++mScaledFontHits;
+    }
+    return found->second;
+
+} // Surface::scaled_font
+
+// ----------------------------------------------------------------------
+
 void Surface::test()
 {
     line({100, 100}, {300, 100}, 0xFF00FF, 1);
@@ -351,7 +1118,18 @@ void TreePart::setup(TreeImage& aMain, const Tree& aTre)
 {
     auto const tre_wh = aTre.width_height();
     mNumberOfLines = tre_wh.second;
+    mLabels.resize(mNumberOfLines);
+    Surface& surface = aMain.surface();
+    iterate<const Node&>(aTre, [this, &surface](const Node& aNode) { mLabels[aNode.line_no] = surface.glyph_run(aNode.display_name()); });
+    mLeafExtents.resize(mNumberOfLines);
+    collect_leaf_extents(aTre, mRootEdge);
+    mMaxLabelWidth = 0.0;
+    for (const auto& leaf: mLeafExtents)
+        mMaxLabelWidth = std::max(mMaxLabelWidth, leaf.label_width);
+    collect_annotation_margins(aTre);
     mVerticalStep = aMain.viewport().size.height / (mNumberOfLines + 2); // +2 to add space at the top and bottom
+    if (mMinFontSize > 0.0 && (mVerticalStep * mLabelScale) < mMinFontSize)
+        mVerticalStep = mMinFontSize / mLabelScale; // does not fit into one page, see TreeImage::draw_pages
     if (mOrigin.x < 0.0)
         mOrigin = {aMain.viewport().origin.x, aMain.viewport().origin.y + mVerticalStep};
     else
@@ -361,38 +1139,52 @@ void TreePart::setup(TreeImage& aMain, const Tree& aTre)
 
 // ----------------------------------------------------------------------
 
-void TreePart::draw(TreeImage& aMain, const Tree& aTre, const Coloring& aColoring, int aNumberStrainsThreshold, bool aShowBranchIds)
+void TreePart::draw(TreeImage& aMain, Surface& surface, const Tree& aTre, int aNumberStrainsThreshold, bool aShowBranchIds, const Viewport& aClip)
 {
-    draw_node(aMain, aTre, origin().x, aColoring, aNumberStrainsThreshold, aShowBranchIds, mRootEdge);
+    draw_node(aMain, surface, DRAW_LINES, aTre, origin().x, aNumberStrainsThreshold, aShowBranchIds, aClip, mRootEdge);
+    surface.flush_lines();      // before any text, lines must not be drawn over labels
+    draw_node(aMain, surface, DRAW_TEXT, aTre, origin().x, aNumberStrainsThreshold, aShowBranchIds, aClip, mRootEdge);
 
 } // TreePart::draw
 
 // ----------------------------------------------------------------------
 
-void TreePart::draw_node(TreeImage& aMain, const Node& aNode, double aLeft, const Coloring& aColoring, int aNumberStrainsThreshold, bool aShowBranchIds, double aEdgeLength)
+void TreePart::draw_node(TreeImage& aMain, Surface& surface, DrawPass aPass, const Node& aNode, double aLeft, int aNumberStrainsThreshold, bool aShowBranchIds, const Viewport& aClip, double aEdgeLength)
 {
-    Surface& surface = aMain.surface();
     const double right = aLeft + (aEdgeLength < 0.0 ? aNode.edge_length : aEdgeLength) * mHorizontalStep;
+    if (!subtree_visible(aNode, aLeft, right, aClip))
+        return;
     const double y = mOrigin.y + mVerticalStep * aNode.middle();
 
-    surface.line({aLeft, y}, {right, y}, mLineColor, mLineWidth);
+    if (aPass == DRAW_LINES)
+        surface.line_batched({aLeft, y}, {right, y}, mLineColor, mLineWidth);
     if (aNode.is_leaf()) {
-        const std::string text = aNode.display_name();
-        auto const font_size = mVerticalStep * mLabelScale;
-        auto const tsize = surface.text_size(text, font_size, Surface::FONT_DEFAULT, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-        surface.text({right + name_offset(), y + tsize.height * 0.5}, text, aColoring(aNode), font_size, Surface::FONT_DEFAULT, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-          // std::cerr << (right + name_offset() + tsize.width) << " " << text << std::endl;
+        if (aPass == DRAW_TEXT) {
+            const GlyphRun& text = label(aNode);
+            auto const font_size = mVerticalStep * mLabelScale;
+            auto const tsize = text.size(font_size);
+            surface.text({right + name_offset(), y + tsize.height * 0.5}, text, aMain.leaf_colors()[aNode.line_no], font_size);
+              // std::cerr << (right + name_offset() + tsize.width) << " " << text << std::endl;
+        }
     }
     else {
-        if (aShowBranchIds && !aNode.branch_id.empty()) {
-            show_branch_id(surface, aNode.branch_id, aLeft, y);
+        if (aPass == DRAW_TEXT) {
+            if (aShowBranchIds && !aNode.branch_id.empty()) {
+                show_branch_id(surface, aNode.branch_id, aLeft, y);
+            }
+            if (!aNode.name.empty() && aNode.number_strains > aNumberStrainsThreshold) {
+                show_branch_annotation(surface, aNode.branch_id, aNode.name, aLeft, right, y);
+            }
         }
-        if (!aNode.name.empty() && aNode.number_strains > aNumberStrainsThreshold) {
-            show_branch_annotation(surface, aNode.branch_id, aNode.name, aLeft, right, y);
+        if (collapsed(aNode)) {
+            draw_collapsed(surface, aPass, aNode, right);
         }
-        surface.line({right, mOrigin.y + mVerticalStep * aNode.top}, {right, mOrigin.y + mVerticalStep * aNode.bottom}, mLineColor, mLineWidth);
-        for (auto node = aNode.subtree.begin(); node != aNode.subtree.end(); ++node) {
-            draw_node(aMain, *node, right, aColoring, aNumberStrainsThreshold, aShowBranchIds);
+        else {
+            if (aPass == DRAW_LINES)
+                surface.line_batched({right, mOrigin.y + mVerticalStep * aNode.top}, {right, mOrigin.y + mVerticalStep * aNode.bottom}, mLineColor, mLineWidth);
+            for (auto node = aNode.subtree.begin(); node != aNode.subtree.end(); ++node) {
+                draw_node(aMain, surface, aPass, *node, right, aNumberStrainsThreshold, aShowBranchIds, aClip);
+            }
         }
     }
 
@@ -400,6 +1192,101 @@ void TreePart::draw_node(TreeImage& aMain, const Node& aNode, double aLeft, cons
 
 // ----------------------------------------------------------------------
 
+bool TreePart::collapsed(const Node& aNode) const
+{
+    return mLodMinHeight > 0.0 && !aNode.is_leaf() && (aNode.bottom - aNode.top) * mVerticalStep < mLodMinHeight;
+
+} // TreePart::collapsed
+
+// ----------------------------------------------------------------------
+
+bool TreePart::lines_visible(size_t aFirstLine, size_t aLastLine, const Viewport& aClip) const
+{
+      // one step margin for labels around leaf lines, more if branch annotations reach farther
+    const double margin = std::max(mVerticalStep * std::max(1.0, mLabelScale), mAnnotationMarginY.at(mVerticalStep * mLabelScale));
+    return (mOrigin.y + mVerticalStep * aLastLine + margin) >= aClip.origin.y && (mOrigin.y + mVerticalStep * aFirstLine - margin) <= aClip.opposite().y;
+
+} // TreePart::lines_visible
+
+// ----------------------------------------------------------------------
+
+  // Bounding box of a subtree: leaf lines vertically, from the left end of the branch
+  // leading to it to the farthest leaf plus the longest label horizontally.
+
+bool TreePart::subtree_visible(const Node& aNode, double aLeft, double aRight, const Viewport& aClip) const
+{
+    const double far = aRight + aNode.subtree_edge_length * mHorizontalStep + name_offset() + mMaxLabelWidth * mVerticalStep * mLabelScale;
+    const double margin_x = mAnnotationMarginX.at(mVerticalStep * mLabelScale);
+    return lines_visible(aNode.first_line, aNode.last_line, aClip) && (far + margin_x) >= aClip.origin.x && (aLeft - margin_x) <= aClip.opposite().x;
+
+} // TreePart::subtree_visible
+
+// ----------------------------------------------------------------------
+
+  // Conservative: every named subtree may be annotated (number strains threshold is not
+  // known here), every branch id may be shown, text height and monospace advance are
+  // taken as the font size.
+void TreePart::collect_annotation_margins(const Tree& aTre)
+{
+    mAnnotationMarginY = mAnnotationMarginX = AnnotationMargin();
+    auto extend = [](AnnotationMargin& aMargin, double aFontSize, double aFactor, double aFixed) {
+        if (aFontSize > 0.0) {
+            aMargin.absolute = std::max(aMargin.absolute, aFontSize * aFactor + aFixed);
+        }
+        else {
+            aMargin.absolute = std::max(aMargin.absolute, aFixed);
+            aMargin.relative = std::max(aMargin.relative, - aFontSize * aFactor);
+        }
+    };
+    iterate<const Node&>(aTre, [&](const Node& aNode) {
+        if (aNode.is_leaf())
+            return;
+        if (!aNode.branch_id.empty()) {
+            extend(mAnnotationMarginY, mBranchAnnotationsAll.branch_id_font_size, 1.0, std::abs(mBranchAnnotationsAll.branch_id_offset_y));
+            extend(mAnnotationMarginX, mBranchAnnotationsAll.branch_id_font_size, static_cast<double>(aNode.branch_id.size()), std::abs(mBranchAnnotationsAll.branch_id_offset_x));
+        }
+        if (!aNode.name.empty()) {
+            const auto& ba = find_branch_annotation(aNode.branch_id);
+            if (ba.show) {
+                const std::string& label = ba.label.empty() ? aNode.name : ba.label;
+                size_t number_of_lines = 0, longest_line = 0;
+                for (std::string::size_type pos = 0; pos != std::string::npos; ++number_of_lines) {
+                    const auto end = label.find('\n', pos);
+                    longest_line = std::max(longest_line, (end == std::string::npos ? label.size() : end) - pos);
+                    pos = end == std::string::npos ? end : end + 1;
+                }
+                const double line_extent = ba.show_line ? std::abs(ba.line_y) + ba.line_width : 0.0;
+                extend(mAnnotationMarginY, ba.font_size, number_of_lines * std::max(1.0, ba.label_interleave), std::abs(ba.label_offset_y) + line_extent);
+                extend(mAnnotationMarginX, ba.font_size, static_cast<double>(longest_line), std::abs(ba.label_offset_x) + (ba.show_line ? std::abs(ba.line_x) : 0.0));
+            }
+        }
+    });
+
+} // TreePart::collect_annotation_margins
+
+// ----------------------------------------------------------------------
+
+  // Subtree is replaced with a wedge from the node to its farthest leaf
+  // spanning the subtree vertically, followed by the number of leaves.
+
+void TreePart::draw_collapsed(Surface& surface, DrawPass aPass, const Node& aNode, double aRight)
+{
+    const double top = mOrigin.y + mVerticalStep * aNode.top;
+    const double bottom = mOrigin.y + mVerticalStep * aNode.bottom;
+    const double far = aRight + aNode.subtree_edge_length * mHorizontalStep;
+    if (aPass == DRAW_LINES) {
+        surface.triangle({aRight, (top + bottom) * 0.5}, {far, top}, {far, bottom}, mLineColor);
+    }
+    else {
+        auto const font_size = mVerticalStep * mLabelScale;
+        const GlyphRun text = surface.glyph_run(std::to_string(aNode.number_leaves));
+        surface.text({far + name_offset(), (top + bottom + text.size(font_size).height) * 0.5}, text, mLineColor, font_size);
+    }
+
+} // TreePart::draw_collapsed
+
+// ----------------------------------------------------------------------
+
 void TreePart::show_branch_annotation(Surface& surface, std::string branch_id, std::string branch_annotation, double branch_left, double branch_right, double branch_y)
 {
     auto const ba = find_branch_annotation(branch_id); // mBranchAnnotationsAll; //
@@ -412,12 +1299,13 @@ void TreePart::show_branch_annotation(Surface& surface, std::string branch_id, s
             std::string::size_type end = label.find('\n', pos);
             auto font_size = ba.font_size > 0 ? ba.font_size : mVerticalStep * mLabelScale * (-ba.font_size);
             auto text = end == std::string::npos ? std::string(label, pos) : std::string(label, pos, end - pos);
-            auto const ts = surface.text_size(text.empty() ? "I" : text, font_size, Surface::FONT_MONOSPACE, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+            auto const run = surface.glyph_run(text, Surface::FONT_MONOSPACE); // shaped once, used for measuring and drawing
+            auto const ts = text.empty() ? surface.text_size("I", font_size, Surface::FONT_MONOSPACE, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL) : run.size(font_size);
             auto text_x = branch_center - ts.width / 2.0;
             if (ba.label_offset_x == 0.0 && (text_x + ts.width) > branch_right)
                 text_x = branch_right - ts.width;
             text_y += ts.height * ba.label_interleave;
-            surface.text({text_x + ba.label_offset_x, text_y + ba.label_offset_y}, text, ba.color, font_size, Surface::FONT_MONOSPACE, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+            surface.text({text_x + ba.label_offset_x, text_y + ba.label_offset_y}, run, ba.color, font_size, Surface::FONT_MONOSPACE);
             if ((text_x + ba.label_offset_x) < 0)
                 std::cerr << text << " " << (text_x + ba.label_offset_x) << std::endl;
             if (end == std::string::npos)
@@ -444,14 +1332,20 @@ void TreePart::show_branch_id(Surface& surface, std::string id, double branch_le
 
 // ----------------------------------------------------------------------
 
-void TreePart::adjust_label_scale(TreeImage& aMain, const Tree& aTre, double tree_right_margin)
+void TreePart::adjust_label_scale(TreeImage& /*aMain*/, const Tree& /*aTre*/, double tree_right_margin)
 {
-      // std::cerr << "right_margin: " << tree_right_margin << " viewport: " << aMain.viewport().size.width << " ts width: " << aMain.time_series().width() << "  ts space: " << aMain.space_tree_ts() << "  clades width: " << aMain.clades().width() << "  clades space: " << aMain.space_ts_clades() << std::endl;
-    mWidth = tree_width(aMain, aTre);
-    for (int i = 0; (mLabelScale * mVerticalStep) > 1.0 && (mWidth + mOrigin.x) > tree_right_margin; ++i) {
-        mLabelScale *= 0.95;
-        mWidth = tree_width(aMain, aTre, mRootEdge);
-          // std::cerr << i << " label scale: " << mLabelScale << "  width:" << mWidth << " right:" << tree_right_margin << std::endl;
+    const double available = tree_right_margin - mOrigin.x;
+    mWidth = tree_width();
+    const double min_font_size = std::max(1.0, mMinFontSize);
+    if ((mLabelScale * mVerticalStep) > min_font_size && mWidth > available) {
+          // largest scale at which every label fits: depth * h + label_width * v * s + offset <= available
+        double fit_scale = mLabelScale;
+        for (const auto& leaf: mLeafExtents) {
+            if (leaf.label_width > 0.0)
+                fit_scale = std::min(fit_scale, (available - leaf.depth * mHorizontalStep - name_offset()) / (leaf.label_width * mVerticalStep));
+        }
+        mLabelScale = std::max(fit_scale, min_font_size / mVerticalStep); // labels are not made smaller than 1pt or min_font_size
+        mWidth = tree_width();
     }
       // std::cerr << "Label scale: " << mLabelScale << "  width:" << mWidth << " right:" << tree_right_margin << std::endl;
 
@@ -459,46 +1353,73 @@ void TreePart::adjust_label_scale(TreeImage& aMain, const Tree& aTre, double tre
 
 // ----------------------------------------------------------------------
 
-void TreePart::adjust_horizontal_step(TreeImage& aMain, const Tree& aTre, double tree_right_margin)
+void TreePart::adjust_horizontal_step(TreeImage& /*aMain*/, const Tree& /*aTre*/, double tree_right_margin)
 {
-    while (true) {
-        const double save_h_step = mHorizontalStep;
-        const double save_width = mWidth;
-        mHorizontalStep *= 1.05;
-        mWidth = tree_width(aMain, aTre, mRootEdge);
-        if ((mWidth + mOrigin.x) >= tree_right_margin) {
-            mHorizontalStep = save_h_step;
-            mWidth = save_width;
-            break;
+    const double available = tree_right_margin - mOrigin.x;
+    const double font_size = mVerticalStep * mLabelScale;
+      // largest step at which the tree fits, step is never decreased
+    double fit_step = -1.0;
+    for (const auto& leaf: mLeafExtents) {
+        if (leaf.depth > 0.0) {
+            const double step = (available - leaf.label_width * font_size - name_offset()) / leaf.depth;
+            if (fit_step < 0.0 || step < fit_step)
+                fit_step = step;
         }
     }
+    if (fit_step > mHorizontalStep) {
+        mHorizontalStep = fit_step;
+        mWidth = tree_width();
+    }
 
 } // TreePart::adjust_horizontal_step
 
 // ----------------------------------------------------------------------
 
-double TreePart::tree_width(TreeImage& aMain, const Node& aNode, double aEdgeLength) const
+void TreePart::collect_leaf_extents(const Node& aNode, double aDepth)
 {
-    Surface& surface = aMain.surface();
-    double r = 0;
-    const double right = (aEdgeLength < 0.0 ? aNode.edge_length : aEdgeLength) * mHorizontalStep;
     if (aNode.is_leaf()) {
-        auto const font_size = mVerticalStep * mLabelScale;
-        r = surface.text_size(aNode.display_name(), font_size, Surface::FONT_DEFAULT, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL).width + name_offset();
+        mLeafExtents[aNode.line_no] = {aDepth, label(aNode).size(1.0).width};
     }
     else {
         for (auto node = aNode.subtree.begin(); node != aNode.subtree.end(); ++node) {
-            const double node_r = tree_width(aMain, *node);
-            if (node_r > r)
-                r = node_r;
+            collect_leaf_extents(*node, aDepth + node->edge_length);
         }
     }
-    return r + right;
+
+} // TreePart::collect_leaf_extents
+
+// ----------------------------------------------------------------------
+
+double TreePart::tree_width() const
+{
+    const double font_size = mVerticalStep * mLabelScale;
+    double r = 0;
+    for (const auto& leaf: mLeafExtents) {
+        r = std::max(r, leaf.depth * mHorizontalStep + leaf.label_width * font_size + name_offset());
+    }
+    return r;
 
 } // TreePart::tree_width
 
 // ----------------------------------------------------------------------
 
+size_t TreePart::lines_per_page(const TreeImage& aMain) const
+{
+      // half step margin at the top and at the bottom of the page
+    return std::max(static_cast<size_t>(1), static_cast<size_t>((aMain.viewport().size.height - mVerticalStep) / mVerticalStep));
+
+} // TreePart::lines_per_page
+
+// ----------------------------------------------------------------------
+
+const GlyphRun& TreePart::label(const Node& aNode) const
+{
+    return mLabels[aNode.line_no];
+
+} // TreePart::label
+
+// ----------------------------------------------------------------------
+
 const TreePart::BranchAnnotation& TreePart::find_branch_annotation(std::string branch_id) const
 {
     auto i = std::find_if(mBranchAnnotations.cbegin(), mBranchAnnotations.cend(), [&branch_id](const auto& ba) { return ba.id == branch_id; });
@@ -518,6 +1439,10 @@ json TreePart::dump_to_json() const
         {"line_color", mLineColor},
         {"name_offset", mNameOffset},
         {"root_edge", mRootEdge},
+        {"min_font_size", mMinFontSize},
+        {"min_font_size_comment", "if positive, labels are not made smaller, tree is split into several pages instead"},
+        {"lod_min_height", mLodMinHeight},
+        {"lod_min_height_comment", "if positive, subtrees spanning less than this (in points) are drawn as a wedge with the number of leaves"},
 
         {"origin_x", mOrigin.x},
           // for information, not re-read
@@ -545,6 +1470,8 @@ void TreePart::load_from_json(const json& j)
     from_json(j, "line_color", mLineColor);
     from_json_if_non_negative(j, "name_offset", mNameOffset);
     from_json_if_non_negative(j, "root_edge", mRootEdge);
+    from_json_if_non_negative(j, "min_font_size", mMinFontSize);
+    from_json_if_non_negative(j, "lod_min_height", mLodMinHeight);
     from_json_if_non_negative(j, "origin_x", mOrigin.x);
     from_json(j, "branch_annotations_all", mBranchAnnotationsAll);
 
@@ -581,23 +1508,126 @@ void TimeSeries::setup(TreeImage& /*aMain*/, const Tree& aTre)
 
 // ----------------------------------------------------------------------
 
-void TimeSeries::draw(TreeImage& aMain, const Tree& aTre, const Coloring& aColoring, bool aShowSubtreesTopBottom)
+void TimeSeries::draw_header(TreeImage& aMain, Surface& surface)
 {
     if (mNumberOfMonths > 1) {
-        draw_labels(aMain);
-        draw_month_separators(aMain);
-        draw_dashes(aMain, aTre, aColoring);
+        draw_labels(aMain, surface);
+        draw_month_separators(aMain, surface);
+    }
+
+} // TimeSeries::draw_header
+
+// ----------------------------------------------------------------------
+
+void TimeSeries::prepare(TreeImage& aMain, const Tree& aTre)
+{
+    mLeafMonth.assign(aMain.tree().number_of_lines(), -1);
+    iterate<const Node&>(aTre, [this](const Node& aNode) { mLeafMonth[aNode.line_no] = aNode.months_from(mBegin); });
+    if (!mHeatmap.empty())
+        prepare_heatmap(aMain.tree().vertical_step(), aMain.leaf_colors());
+
+} // TimeSeries::prepare
+
+// ----------------------------------------------------------------------
+
+  // Leaves are counted per (band, month, color) in one pass over the per-leaf arrays,
+  // drawing then costs one rectangle per non-empty cell regardless of the number of leaves.
+void TimeSeries::prepare_heatmap(double aVerticalStep, const std::vector<Color>& aLeafColors)
+{
+    if (mHeatmap != "count" && mHeatmap != "majority")
+        throw TreeImageError("unrecognized time_series.heatmap: " + mHeatmap + " (\"count\" or \"majority\" expected)");
+    const size_t number_of_lines = mLeafMonth.size();
+    mHeatmapLinesPerBand = std::max(static_cast<size_t>(1), static_cast<size_t>(std::round(mHeatmapBandHeight / aVerticalStep)));
+    const size_t number_of_bands = (number_of_lines + mHeatmapLinesPerBand - 1) / mHeatmapLinesPerBand;
+
+      // colors are replaced with indices in the palette of colors used, for "count" there is just one
+    std::vector<Color> palette(1, mHeatmapColor);
+    std::vector<size_t> color_index(number_of_lines, 0);
+    if (mHeatmap == "majority") {
+        std::map<Color, size_t> palette_index;
+        palette.clear();
+        for (size_t line = 0; line < number_of_lines; ++line) {
+            auto inserted = palette_index.emplace(aLeafColors[line], palette.size());
+            if (inserted.second)
+                palette.push_back(aLeafColors[line]);
+            color_index[line] = inserted.first->second;
+        }
+    }
+
+    const size_t number_of_cells = number_of_bands * mNumberOfMonths;
+    std::vector<size_t> counts(number_of_cells * palette.size(), 0);
+    for (size_t line = 0; line < number_of_lines; ++line) {
+        const int month_no = mLeafMonth[line];
+        if (month_no >= 0 && static_cast<size_t>(month_no) < mNumberOfMonths)
+            ++counts[((line / mHeatmapLinesPerBand) * mNumberOfMonths + static_cast<size_t>(month_no)) * palette.size() + color_index[line]];
+    }
+
+    mHeatmapCells.assign(number_of_cells, {0, mHeatmapColor});
+    mHeatmapMaxCount = 0;
+    for (size_t cell = 0; cell < number_of_cells; ++cell) {
+        auto const cell_counts = counts.cbegin() + static_cast<std::ptrdiff_t>(cell * palette.size());
+        auto const majority = std::max_element(cell_counts, cell_counts + static_cast<std::ptrdiff_t>(palette.size()));
+        mHeatmapCells[cell].count = static_cast<size_t>(std::accumulate(cell_counts, cell_counts + static_cast<std::ptrdiff_t>(palette.size()), size_t(0)));
+        mHeatmapCells[cell].color = palette[static_cast<size_t>(majority - cell_counts)];
+        mHeatmapMaxCount = std::max(mHeatmapMaxCount, mHeatmapCells[cell].count);
+    }
+
+} // TimeSeries::prepare_heatmap
+
+// ----------------------------------------------------------------------
+
+void TimeSeries::draw_heatmap(TreeImage& aMain, Surface& surface, const Viewport& aClip)
+{
+    auto const base_y = aMain.tree().origin().y;
+    auto const vertical_step = aMain.tree().vertical_step();
+    auto const band_height = vertical_step * mHeatmapLinesPerBand;
+    const size_t number_of_bands = mHeatmapCells.size() / std::max(mNumberOfMonths, static_cast<size_t>(1));
+
+      // band b covers lines [b * lines_per_band, (b + 1) * lines_per_band), half step around leaf lines
+    const double top = base_y - vertical_step * 0.5;
+    const double first = std::floor((aClip.origin.y - top) / band_height);
+    const double last = std::floor((aClip.opposite().y - top) / band_height);
+    if (last < 0.0 || first >= static_cast<double>(number_of_bands))
+        return;
+    const size_t first_band = static_cast<size_t>(std::max(first, 0.0));
+    const size_t last_band = std::min(static_cast<size_t>(last), number_of_bands - 1);
+    const double lines = static_cast<double>(mLeafMonth.size());
+
+    for (size_t band = first_band; band <= last_band; ++band) {
+        const double band_top = top + band_height * band;
+        const double band_bottom = std::min(band_top + band_height, top + vertical_step * lines);
+        for (size_t month_no = 0; month_no < mNumberOfMonths; ++month_no) {
+            const HeatmapCell& cell = mHeatmapCells[band * mNumberOfMonths + month_no];
+            if (cell.count) {
+                Color color = cell.color;
+                if (mHeatmap == "count")
+                    color.alphaI(static_cast<uint32_t>(std::lround(255.0 * (1.0 - static_cast<double>(cell.count) / mHeatmapMaxCount))));
+                surface.rectangle({origin().x + mMonthWidth * month_no, band_top}, {mMonthWidth, band_bottom - band_top}, color);
+            }
+        }
+    }
+
+} // TimeSeries::draw_heatmap
+
+// ----------------------------------------------------------------------
+
+void TimeSeries::draw(TreeImage& aMain, Surface& surface, const Tree& aTre, bool aShowSubtreesTopBottom, const Viewport& aClip)
+{
+    if (mNumberOfMonths > 1 && origin().x <= aClip.opposite().x && (origin().x + width()) >= aClip.origin.x) {
+        if (mHeatmap.empty())
+            draw_dashes(aMain, surface, aTre, aClip);
+        else
+            draw_heatmap(aMain, surface, aClip);
         if (aShowSubtreesTopBottom)
-            draw_subtree_top_bottom(aMain, aTre);
+            draw_subtree_top_bottom(aMain, surface, aTre);
     }
 
 } // TimeSeries::draw
 
 // ----------------------------------------------------------------------
 
-void TimeSeries::draw_labels(TreeImage& aMain)
+void TimeSeries::draw_labels(TreeImage& aMain, Surface& surface)
 {
-    Surface& surface = aMain.surface();
     const double label_font_size = mMonthWidth * mMonthLabelScale;
     auto const month_max_width = surface.text_size("May ", label_font_size, Surface::FONT_DEFAULT, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL).width;
     double x_bearing;
@@ -625,42 +1655,104 @@ void TimeSeries::draw_labels_at_side(Surface& surface, const Location& a, double
 
 // ----------------------------------------------------------------------
 
-void TimeSeries::draw_month_separators(TreeImage& aMain)
+void TimeSeries::draw_month_separators(TreeImage& aMain, Surface& surface)
 {
-    Surface& surface = aMain.surface();
     auto const bottom = aMain.viewport().opposite().y;
     for (size_t month_no = 0; month_no <= mNumberOfMonths; ++month_no) {
         const double left = origin().x + month_no * mMonthWidth;
-        surface.line({left, origin().y}, {left, bottom}, mMonthSeparatorColor, mMonthSeparatorWidth);
+        surface.line_batched({left, origin().y}, {left, bottom}, mMonthSeparatorColor, mMonthSeparatorWidth);
     }
+    surface.flush_lines();
 
 } // TimeSeries::draw_month_separators
 
 // ----------------------------------------------------------------------
 
-void TimeSeries::draw_dashes(TreeImage& aMain, const Tree& aTre, const Coloring& aColoring)
+  // Dashes use month precomputed by prepare() and leaf colors resolved by TreeImage. Segments are collected by Surface
+  // into one path per color. If vertical step is not more than the dash line width, adjacent
+  // dashes overlap, a run of identical dashes in a column is then drawn as one segment.
+void TimeSeries::draw_dashes(TreeImage& aMain, Surface& surface, const Tree& aTre, const Viewport& aClip)
 {
-    Surface& surface = aMain.surface();
     auto const base_x = origin().x + mMonthWidth * (1.0 - mDashWidth) / 2;
     auto const base_y = aMain.tree().origin().y;
     auto const vertical_step = aMain.tree().vertical_step();
+    auto const dash_length = mMonthWidth * mDashWidth;
+    const bool merge_runs = vertical_step <= mDashLineWidth;
+    const std::vector<Color>& leaf_color = aMain.leaf_colors();
+
+    const double first = std::ceil((aClip.origin.y - mDashLineWidth - base_y) / vertical_step);
+    const double last = std::floor((aClip.opposite().y + mDashLineWidth - base_y) / vertical_step);
+    if (last < 0.0 || first >= static_cast<double>(mLeafMonth.size()) || last < first)
+        return;
+    const size_t first_line = static_cast<size_t>(std::max(first, 0.0));
+    const size_t last_line = std::min(static_cast<size_t>(last), mLeafMonth.size() - 1);
+
+      // subtrees collapsed by TreePart get one dash per distinct month and color at the subtree middle
+    std::vector<const Node*> collapsed; // in line order
+    if (aMain.tree().lod_min_height() > 0.0) {
+        std::function<void(const Node&)> find_collapsed = [&](const Node& aNode) {
+            if (aNode.is_leaf() || aNode.last_line < first_line || aNode.first_line > last_line)
+                return;
+            if (aMain.tree().collapsed(aNode)) {
+                collapsed.push_back(&aNode);
+            }
+            else {
+                for (const auto& node: aNode.subtree)
+                    find_collapsed(node);
+            }
+        };
+        find_collapsed(aTre);
+    }
 
-    auto draw_dash = [&](const Node& aNode) {
-        const int month_no = aNode.months_from(mBegin);
+    auto collapsed_subtree = collapsed.cbegin();
+    for (size_t line = first_line; line <= last_line; ) {
+        if (collapsed_subtree != collapsed.cend() && (*collapsed_subtree)->first_line <= line) {
+            const Node& subtree = **collapsed_subtree;
+            std::set<std::pair<int, Color>> dashes;
+            for (size_t leaf = subtree.first_line; leaf <= subtree.last_line; ++leaf) {
+                if (mLeafMonth[leaf] >= 0)
+                    dashes.emplace(mLeafMonth[leaf], leaf_color[leaf]);
+            }
+            const double y = base_y + vertical_step * subtree.middle();
+            for (const auto& dash: dashes) {
+                const double x = base_x + mMonthWidth * dash.first;
+                surface.line_batched({x, y}, {x + dash_length, y}, dash.second, mDashLineWidth, CAIRO_LINE_CAP_ROUND);
+            }
+            line = subtree.last_line + 1;
+            ++collapsed_subtree;
+            continue;
+        }
+
+        const int month_no = mLeafMonth[line];
+        size_t run_end = line + 1;
+        if (merge_runs) {
+            while (run_end <= last_line && mLeafMonth[run_end] == month_no && leaf_color[run_end] == leaf_color[line]
+                   && (collapsed_subtree == collapsed.cend() || (*collapsed_subtree)->first_line > run_end))
+                ++run_end;
+        }
         if (month_no >= 0) {
-            const Location a {base_x + mMonthWidth * month_no, base_y + vertical_step * aNode.line_no};
-            surface.line(a, {a.x + mMonthWidth * mDashWidth, a.y}, aColoring(aNode), mDashLineWidth, CAIRO_LINE_CAP_ROUND);
+            const double x = base_x + mMonthWidth * month_no;
+            const double y = base_y + vertical_step * line;
+            if (run_end - line > 1) {
+                  // overlapping round capped dashes form a block, drawn as a vertical segment as wide as dash
+                const double x_middle = x + dash_length * 0.5;
+                const double half_width = mDashLineWidth * 0.5;
+                surface.line_batched({x_middle, y - half_width}, {x_middle, base_y + vertical_step * (run_end - 1) + half_width}, leaf_color[line], dash_length + mDashLineWidth);
+            }
+            else {
+                surface.line_batched({x, y}, {x + dash_length, y}, leaf_color[line], mDashLineWidth, CAIRO_LINE_CAP_ROUND);
+            }
         }
-    };
-    iterate<const Node&>(aTre, draw_dash);
+        line = run_end;
+    }
+    surface.flush_lines();
 
 } // TimeSeries::draw_dashes
 
 // ----------------------------------------------------------------------
 
-void TimeSeries::draw_subtree_top_bottom(TreeImage& aMain, const Tree& aTre)
+void TimeSeries::draw_subtree_top_bottom(TreeImage& aMain, Surface& surface, const Tree& aTre)
 {
-    Surface& surface = aMain.surface();
     auto const base_y = aMain.tree().origin().y;
     auto const vertical_step = aMain.tree().vertical_step();
     for (auto entry = mSubtreeTopBottom.cbegin(); entry != mSubtreeTopBottom.end(); ++entry) {
@@ -691,6 +1783,11 @@ json TimeSeries::dump_to_json() const
         {"max_number_of_months", mMaxNumberOfMonths},
         {"month_separator_color", mMonthSeparatorColor},
         {"month_separator_width", mMonthSeparatorWidth},
+        {"heatmap", mHeatmap},
+        {"heatmap_comment", "\"count\" or \"majority\": leaves are binned into cells (band of leaf lines x month) drawn instead of dashes, empty: dash per leaf"},
+        {"heatmap_band_height", mHeatmapBandHeight},
+        {"heatmap_color", mHeatmapColor},
+        {"heatmap_color_comment", "for \"count\", opacity of a cell is proportional to the number of leaves in it; \"majority\" uses the most frequent leaf color"},
 
         {"origin_x", mOrigin.x},
           // for information, not re-read
@@ -718,6 +1815,9 @@ void TimeSeries::load_from_json(const json& j)
     from_json_if_non_negative(j, "max_number_of_months", mMaxNumberOfMonths);
     from_json(j, "month_separator_color", mMonthSeparatorColor);
     from_json_if_non_negative(j, "month_separator_width", mMonthSeparatorWidth);
+    from_json(j, "heatmap", mHeatmap);
+    from_json_if_non_negative(j, "heatmap_band_height", mHeatmapBandHeight);
+    from_json(j, "heatmap_color", mHeatmapColor);
     from_json_if_non_negative(j, "origin_x", mOrigin.x);
 
     mSubtreeTopBottom.clear();
@@ -756,11 +1856,11 @@ void Clades::setup(TreeImage& aMain, const Tree& aTre)
 
 // ----------------------------------------------------------------------
 
-void Clades::draw(TreeImage& aMain, const Tree& /*aTre*/)
+void Clades::draw(TreeImage& aMain, Surface& surface, const Tree& /*aTre*/, const Viewport& aClip)
 {
     for (auto c = mClades.cbegin(); c != mClades.cend(); ++c) {
-        if (c->show) {
-            draw_clade(aMain, *c);
+        if (c->show && aMain.tree().lines_visible(static_cast<size_t>(std::max(c->begin, 0)), static_cast<size_t>(std::max(c->end, 0)), aClip)) {
+            draw_clade(aMain, surface, *c);
         }
     }
 
@@ -768,9 +1868,8 @@ void Clades::draw(TreeImage& aMain, const Tree& /*aTre*/)
 
 // ----------------------------------------------------------------------
 
-void Clades::draw_clade(TreeImage& aMain, const CladeArrow& aClade)
+void Clades::draw_clade(TreeImage& aMain, Surface& surface, const CladeArrow& aClade)
 {
-    Surface& surface = aMain.surface();
     auto const x = origin().x + aClade.slot * mSlotWidth;
     auto const base_y = aMain.tree().origin().y;
     auto const vertical_step = aMain.tree().vertical_step();
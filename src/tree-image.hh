@@ -3,6 +3,9 @@
 #include <string>
 #include <stdexcept>
 #include <functional>
+#include <unordered_map>
+#include <map>
+#include <tuple>
 
 #include "cairo.hh"
 #include "date.hh"
@@ -104,37 +107,119 @@ inline std::ostream& operator << (std::ostream& out, const Viewport& aViewport)
 
 // ----------------------------------------------------------------------
 
+// Text converted to glyphs once (at unit font size), can be measured and drawn many times at any size
+class GlyphRun
+{
+ public:
+    inline GlyphRun() : mXBearing(0), mYBearing(0), mXAdvance(0) {}
+
+    inline Size size(double aSize) const { return {mXAdvance * aSize, - mYBearing * aSize}; }
+    inline double x_bearing(double aSize) const { return mXBearing * aSize; }
+    inline bool empty() const { return mGlyphs.empty(); }
+
+ private:
+    std::vector<cairo_glyph_t> mGlyphs; // positioned relative to the origin of the run
+    double mXBearing, mYBearing, mXAdvance;
+
+    friend class Surface;
+
+}; // class GlyphRun
+
+// ----------------------------------------------------------------------
+
 class Surface
 {
  public:
     enum FontStyle { FONT_DEFAULT, FONT_MONOSPACE };
 
-    inline Surface() : mContext(nullptr) {}
+    inline Surface() : mContext(nullptr), mRasterScale(1.0), mTextExtentsHits(0), mTextExtentsMisses(0), mScaledFontHits(0), mScaledFontMisses(0), mFontFacesCreated(0) {}
+    ~Surface();
 
-    inline ~Surface()
-        {
-            if (mContext != nullptr)
-                cairo_destroy(mContext);
-        }
-
-    void setup(std::string aFilename, const Size& aCanvasSize);
+      // output format is selected by aFilename suffix: .png - raster (aRasterScale pixels per point), otherwise pdf
+    void setup(std::string aFilename, const Size& aCanvasSize, double aRasterScale = 1.0);
+    void setup_recording(const Size& aCanvasSize); // drawing is recorded to be painted onto another surface later
+    void finish();              // must be called after drawing, writes raster output
+    inline bool raster() const { return !mRasterFilename.empty(); }
+    void resize_raster(const Size& aCanvasSize); // raster output only, before anything is drawn
 
     const Size& canvas_size() const { return mCanvasSize; }
 
     void line(const Location& a, const Location& b, const Color& aColor, double aWidth, cairo_line_cap_t aLineCap = CAIRO_LINE_CAP_BUTT);
+      // segment is collected and drawn by flush_lines() using one path and one stroke per (color, width, line cap)
+    void line_batched(const Location& a, const Location& b, const Color& aColor, double aWidth, cairo_line_cap_t aLineCap = CAIRO_LINE_CAP_BUTT);
+    void flush_lines();
+      // drawing until pop_clip() is clipped by aClip and shifted by aOffset
+    void push_clip(const Viewport& aClip, const Location& aOffset);
+    void pop_clip();
+    void paint(const Surface& aRecording);
+      // recording surface saved as a cairo script and replayed into another recording surface (see TreeImage::cache_directory)
+    void save_recording(std::string aFilename);
+    void load_recording(std::string aFilename);
+    void show_page();
     void double_arrow(const Location& a, const Location& b, const Color& aColor, double aLineWidth, double aArrowWidth);
+    void triangle(const Location& a, const Location& b, const Location& c, const Color& aColor); // filled
+    void rectangle(const Location& a, const Size& s, const Color& aColor); // filled
     void text(const Location& a, std::string aText, const Color& aColor, double aSize, FontStyle aFontStyle = FONT_DEFAULT, cairo_font_slant_t aSlant = CAIRO_FONT_SLANT_NORMAL, cairo_font_weight_t aWeight = CAIRO_FONT_WEIGHT_NORMAL, double aRotation = 0);
 
     Size text_size(std::string aText, double aSize, FontStyle aFontStyle, cairo_font_slant_t aSlant, cairo_font_weight_t aWeight, double* x_bearing = nullptr);
 
+    GlyphRun glyph_run(std::string aText, FontStyle aFontStyle = FONT_DEFAULT, cairo_font_slant_t aSlant = CAIRO_FONT_SLANT_NORMAL, cairo_font_weight_t aWeight = CAIRO_FONT_WEIGHT_NORMAL);
+    void text(const Location& a, const GlyphRun& aRun, const Color& aColor, double aSize, FontStyle aFontStyle = FONT_DEFAULT, cairo_font_slant_t aSlant = CAIRO_FONT_SLANT_NORMAL, cairo_font_weight_t aWeight = CAIRO_FONT_WEIGHT_NORMAL);
+
     void test();
+    void print_statistics(std::ostream& out) const; // text extents and font cache counters, e.g. after TreeImage::make_pdf
+    void add_statistics(const Surface& aSource);    // counters of a panel or page surface painted onto this one
 
  private:
+    struct TextExtentsKey
+    {
+        std::string text;
+        FontStyle font_style;
+        cairo_font_slant_t slant;
+        cairo_font_weight_t weight;
+
+        inline bool operator == (const TextExtentsKey& a) const { return text == a.text && font_style == a.font_style && slant == a.slant && weight == a.weight; }
+    };
+
+    struct TextExtentsKeyHash
+    {
+        inline size_t operator()(const TextExtentsKey& a) const { return std::hash<std::string>()(a.text) ^ (static_cast<size_t>(a.font_style) << 1) ^ (static_cast<size_t>(a.slant) << 3) ^ (static_cast<size_t>(a.weight) << 5); }
+    };
+
+    struct TextExtents          // at unit font size, pdf surface metrics are not hinted and scale linearly
+    {
+        double x_bearing;
+        double y_bearing;
+        double x_advance;
+    };
+
+    struct LineBatch
+    {
+        Color color;
+        double width;
+        cairo_line_cap_t line_cap;
+        std::vector<Location> points; // pairs of segment ends
+    };
+
     cairo_t* mContext;
     Size mCanvasSize;
+    std::string mRasterFilename; // if not empty, drawing is recorded and rasterized by finish()
+    double mRasterScale;
+    std::map<std::tuple<size_t, double, int>, LineBatch> mLineBatches;
+      // font faces are resolved (fontconfig lookup) once per style, scaled fonts are made once per size
+    std::map<std::tuple<int, int, int>, cairo_font_face_t*> mFontFaces;
+    std::map<std::tuple<int, int, int, double>, cairo_scaled_font_t*> mScaledFonts;
+    std::unordered_map<TextExtentsKey, TextExtents, TextExtentsKeyHash> mTextExtentsCache;
+    size_t mTextExtentsHits, mTextExtentsMisses;
+    size_t mScaledFontHits, mScaledFontMisses;
+    size_t mFontFacesCreated;
+    std::vector<cairo_glyph_t> mGlyphBuffer; // glyphs of a run positioned for drawing, reused by text()
 
     Location arrow_head(const Location& a, double angle, double sign, const Color& aColor, double aArrowWidth);
+    void write_png_tiled();
     void context_prepare_for_text(double aSize, FontStyle aFontStyle, cairo_font_slant_t aSlant, cairo_font_weight_t aWeight);
+    cairo_font_face_t* font_face(FontStyle aFontStyle, cairo_font_slant_t aSlant, cairo_font_weight_t aWeight);
+    cairo_scaled_font_t* scaled_font(double aSize, FontStyle aFontStyle, cairo_font_slant_t aSlant, cairo_font_weight_t aWeight);
 
 }; // class Surface
 
@@ -238,14 +323,19 @@ class Coloring
     Coloring(const Coloring&) = default;
     virtual ~Coloring() = default;
     virtual Color operator()(const Node&) const = 0;
+      // colors of aNumber nodes, one virtual call per batch, see TreeImage::resolve_leaf_colors
+    virtual void resolve(const Node* const* aNodes, size_t aNumber, Color* aResult) const = 0;
     virtual void draw_legend(Surface& aSurface, const Location& aLocation, const ColoringSettings& aSettings) const = 0;
+    virtual std::string id() const = 0; // distinguishes colorings in the panel cache keys
 };
 
-class ColoringBlack : public Coloring
+class ColoringBlack final : public Coloring
 {
  public:
     virtual inline Color operator()(const Node&) const { return 0; }
+    virtual inline void resolve(const Node* const*, size_t aNumber, Color* aResult) const { std::fill(aResult, aResult + aNumber, Color(0)); }
     virtual void draw_legend(Surface&, const Location&, const ColoringSettings&) const {}
+    virtual inline std::string id() const { return "black"; }
 };
 
 // ----------------------------------------------------------------------
@@ -253,13 +343,15 @@ class ColoringBlack : public Coloring
 class TimeSeries
 {
  public:
-    inline TimeSeries() : mShow(true), mMonthWidth(10.0), mDashWidth(0.5), mDashLineWidth(1.0), mMonthLabelScale(0.9), mMaxNumberOfMonths(20), mMonthSeparatorColor(0), mMonthSeparatorWidth(0.1), mNumberOfMonths(0) {}
+    inline TimeSeries() : mShow(true), mMonthWidth(10.0), mDashWidth(0.5), mDashLineWidth(1.0), mMonthLabelScale(0.9), mMaxNumberOfMonths(20), mMonthSeparatorColor(0), mMonthSeparatorWidth(0.1), mHeatmapBandHeight(2.0), mHeatmapColor(0), mNumberOfMonths(0), mHeatmapLinesPerBand(1), mHeatmapMaxCount(0) {}
 
     inline double width() const { return mShow ? mNumberOfMonths * mMonthWidth : 0.0; }
     inline bool show() const { return mShow; }
 
     void setup(TreeImage& aMain, const Tree& aTre);
-    void draw(TreeImage& aMain, const Tree& aTre, const Coloring& aColoring, bool aShowSubtreesTopBottom);
+    void prepare(TreeImage& aMain, const Tree& aTre); // month of each leaf, heatmap cells, before drawing
+    void draw_header(TreeImage& aMain, Surface& surface); // month labels and separators, repeated on every page
+    void draw(TreeImage& aMain, Surface& surface, const Tree& aTre, bool aShowSubtreesTopBottom, const Viewport& aClip);
 
     inline const Location& origin() const { return mOrigin; }
     inline Location& origin() { return mOrigin; }
@@ -313,15 +405,30 @@ class TimeSeries
     Color mMonthSeparatorColor;
     double mMonthSeparatorWidth;
     std::vector<SubtreeTopBottom> mSubtreeTopBottom;
+    std::string mHeatmap;           // "count" or "majority": leaves are binned into (band x month) cells drawn instead of dashes
+    double mHeatmapBandHeight;      // in points, rounded to whole leaf lines
+    Color mHeatmapColor;            // for "count", opacity is proportional to the number of leaves in a cell
 
     size_t mNumberOfMonths;
     Location mOrigin;
+    std::vector<int> mLeafMonth;     // month index (-1 if before mBegin or no date) by line_no, set by prepare()
 
-    void draw_labels(TreeImage& aMain);
+    struct HeatmapCell
+    {
+        size_t count;
+        Color color;            // majority color of the leaves in the cell
+    };
+    size_t mHeatmapLinesPerBand;
+    std::vector<HeatmapCell> mHeatmapCells; // band * mNumberOfMonths + month, set by prepare()
+    size_t mHeatmapMaxCount;
+
+    void draw_labels(TreeImage& aMain, Surface& surface);
     void draw_labels_at_side(Surface& surface, const Location& a, double label_font_size, double month_max_width);
-    void draw_month_separators(TreeImage& aMain);
-    void draw_dashes(TreeImage& aMain, const Tree& aTre, const Coloring& aColoring);
-    void draw_subtree_top_bottom(TreeImage& aMain, const Tree& aTre);
+    void draw_month_separators(TreeImage& aMain, Surface& surface);
+    void draw_dashes(TreeImage& aMain, Surface& surface, const Tree& aTre, const Viewport& aClip);
+    void prepare_heatmap(double aVerticalStep, const std::vector<Color>& aLeafColors);
+    void draw_heatmap(TreeImage& aMain, Surface& surface, const Viewport& aClip);
+    void draw_subtree_top_bottom(TreeImage& aMain, Surface& surface, const Tree& aTre);
 };
 
 // ----------------------------------------------------------------------
@@ -338,7 +445,7 @@ class Clades
     inline void show(bool aShow) { mShow = aShow; }
 
     void setup(TreeImage& aMain, const Tree& aTre);
-    void draw(TreeImage& aMain, const Tree& aTre);
+    void draw(TreeImage& aMain, Surface& surface, const Tree& aTre, const Viewport& aClip);
 
     inline const Location& origin() const { return mOrigin; }
     inline Location& origin() { return mOrigin; }
@@ -441,7 +548,7 @@ class Clades
         }
 
     void assign_slots(TreeImage& aMain);
-    void draw_clade(TreeImage& aMain, const CladeArrow& aClade);
+    void draw_clade(TreeImage& aMain, Surface& surface, const CladeArrow& aClade);
 
 }; // class Clades
 
@@ -451,18 +558,25 @@ class TreePart
 {
  public:
     inline TreePart() : mHorizontalStep(5.0), mLineWidth(0.2), mLabelScale(1.0), mLineColor(0), mNameOffset(0.2),
-                        mRootEdge(0.0), mOrigin(-1, -1) {}
+                        mRootEdge(0.0), mMinFontSize(0.0), mLodMinHeight(0.0), mOrigin(-1, -1), mMaxLabelWidth(0.0) {}
 
     inline const Location& origin() const { return mOrigin; }
     inline double width() const { return mWidth; }
     inline double name_offset() const { return mNameOffset; }
     inline double vertical_step() const { return mVerticalStep; }
     inline size_t number_of_lines() const { return mNumberOfLines; }
+    inline void min_font_size(double aMinFontSize) { mMinFontSize = aMinFontSize; }
+    inline void lod_min_height(double aLodMinHeight) { mLodMinHeight = aLodMinHeight; }
+    inline double lod_min_height() const { return mLodMinHeight; }
+    bool collapsed(const Node& aNode) const; // subtree is too small vertically and drawn as a single wedge
+    bool lines_visible(size_t aFirstLine, size_t aLastLine, const Viewport& aClip) const; // vertically only
+    size_t lines_per_page(const TreeImage& aMain) const;
 
     void setup(TreeImage& aMain, const Tree& aTre);
     void adjust_label_scale(TreeImage& aMain, const Tree& aTre, double tree_right_margin);
     void adjust_horizontal_step(TreeImage& aMain, const Tree& aTre, double tree_right_margin);
-    void draw(TreeImage& aMain, const Tree& aTre, const Coloring& aColoring, int aNumberStrainsThreshold, bool aShowBranchIds);
+      // subtrees entirely outside aClip are skipped
+    void draw(TreeImage& aMain, Surface& surface, const Tree& aTre, int aNumberStrainsThreshold, bool aShowBranchIds, const Viewport& aClip);
 
     json dump_to_json() const;
     void load_from_json(const json& j);
@@ -569,6 +683,8 @@ class TreePart
     Color mLineColor;
     double mNameOffset;
     double mRootEdge;
+    double mMinFontSize;        // if positive, labels are not made smaller, lines that do not fit are split across pages
+    double mLodMinHeight;       // if positive, subtrees spanning less than this vertically are drawn as a wedge with the number of leaves
 
     double mWidth;
     size_t mNumberOfLines;
@@ -576,12 +692,45 @@ class TreePart
     Location mOrigin;
     BranchAnnotation mBranchAnnotationsAll;
     std::vector<BranchAnnotation> mBranchAnnotations; // for some branch ids
+    std::vector<GlyphRun> mLabels; // Node::display_name() for each leaf indexed by line_no, shaped once
+
+      // Tree width is max over leaves of (depth * mHorizontalStep + label_width * mVerticalStep * mLabelScale + mNameOffset),
+      // per leaf data is collected once in setup, label scale and horizontal step are then solved for directly
+    struct LeafExtent
+    {
+        double depth;           // cumulative edge length from the root, root edge is mRootEdge
+        double label_width;     // at unit font size
+    };
+    std::vector<LeafExtent> mLeafExtents; // indexed by line_no
+    double mMaxLabelWidth;      // at unit font size, for subtree bounding boxes
+
+      // How far branch annotations and branch ids reach from their branch (vertically: lines x
+      // label_interleave x font size + |label_offset_y|, horizontally: longest line + |label_offset_x|),
+      // subtrees are culled with this margin. Fixed part for absolute font sizes, relative part is
+      // multiplied by the label font size (mVerticalStep * mLabelScale).
+    struct AnnotationMargin
+    {
+        double absolute;
+        double relative;
+        inline AnnotationMargin() : absolute(0.0), relative(0.0) {}
+        inline double at(double aLabelFontSize) const { return absolute + relative * aLabelFontSize; }
+    };
+    AnnotationMargin mAnnotationMarginY, mAnnotationMarginX;
+
+    void collect_annotation_margins(const Tree& aTre);
+
+      // tree is drawn in two passes: branch lines and wedges (batched), then labels and annotations on top of them
+    enum DrawPass { DRAW_LINES, DRAW_TEXT };
 
-    void draw_node(TreeImage& aMain, const Node& aNode, double aLeft, const Coloring& aColoring, int aNumberStrainsThreshold, bool aShowBranchIds, double aEdgeLength = -1.0);
-    double tree_width(TreeImage& aMain, const Node& aNode, double aEdgeLength = -1.0) const;
+    void draw_node(TreeImage& aMain, Surface& surface, DrawPass aPass, const Node& aNode, double aLeft, int aNumberStrainsThreshold, bool aShowBranchIds, const Viewport& aClip, double aEdgeLength = -1.0);
+    bool subtree_visible(const Node& aNode, double aLeft, double aRight, const Viewport& aClip) const;
+    void draw_collapsed(Surface& surface, DrawPass aPass, const Node& aNode, double aRight);
+    void collect_leaf_extents(const Node& aNode, double aDepth);
+    double tree_width() const;
     const BranchAnnotation& find_branch_annotation(std::string branch_id) const;
     void show_branch_annotation(Surface& surface, std::string branch_id, std::string branch_annotation, double branch_left, double branch_right, double branch_y);
     void show_branch_id(Surface& surface, std::string id, double branch_left, double branch_y);
+    const GlyphRun& label(const Node& aNode) const;
 
 }; // class TreePart
 
@@ -591,7 +740,7 @@ class TreeImage
 {
  public:
     inline TreeImage()
-        : mBorder(0.1), mSpaceTreeTs(5.0), mSpaceTsClades(5.0)
+        : mBorder(0.1), mSpaceTreeTs(5.0), mSpaceTsClades(5.0), mRasterScale(4.0)
         {
         }
 
@@ -609,10 +758,18 @@ class TreeImage
     inline const Viewport& viewport() const { return mViewport; }
     inline double space_tree_ts() const { return mSpaceTreeTs; }
     inline double space_ts_clades() const { return mSpaceTsClades; }
+    inline void raster_scale(double aRasterScale) { mRasterScale = aRasterScale; } // pixels per point for png output
+      // if not empty, panel drawings are kept there and only panels with changed inputs are redrawn,
+      // aTreeKey identifies the tree source (e.g. file name and modification time), the tree is dumped
+      // to json and hashed only when aTreeKey changes or when it is empty
+    inline void cache_directory(std::string aCacheDirectory, std::string aTreeKey = std::string()) { mCacheDirectory = aCacheDirectory; mCacheTreeKey = aTreeKey; }
+    size_t number_of_pages() const;
+    inline const std::vector<Color>& leaf_colors() const { return mLeafColors; } // by line_no, set by make_pdf
 
       // To be passed to make_pdf
     static Coloring* coloring_by_continent();
     static Coloring* coloring_by_pos(std::string aPos, const Tree& aTree);
+    static Coloring* coloring_by_name(std::string aName, const Tree& aTree); // "continents", "pos:<pos>", "black" or empty
 
     // static inline Coloring coloring_by_posX(std::string aPos, const Tree& aTree)
     //     {
@@ -662,6 +819,9 @@ class TreeImage
     Viewport mViewport;
     double mSpaceTreeTs;
     double mSpaceTsClades;
+    double mRasterScale;
+    std::string mCacheDirectory;
+    std::string mCacheTreeKey;
 
     Surface mSurface;
     TreePart mTree;
@@ -669,10 +829,15 @@ class TreeImage
     Clades mClades;
     Title mTitle;
     ColoringSettings mColoringSettings;
+    std::vector<Color> mLeafColors;
 
     void setup(std::string aFilename, const Tree& aTre, const Size& aCanvasSize);
-    void draw_title();
-    void draw_legend(const Coloring& aColoring);
+    void resolve_leaf_colors(const Tree& aTre, const Coloring& aColoring);
+    void draw_panels(const Tree& aTre, const Coloring& aColoring, int aNumberStrainsThreshold, bool aShowBranchIds, bool aShowSubtreesTopBottom);
+    void draw_pages(const Tree& aTre, const Coloring& aColoring, int aNumberStrainsThreshold, bool aShowBranchIds, bool aShowSubtreesTopBottom);
+    void draw_title(Surface& surface);
+    void draw_legend(Surface& surface, const Coloring& aColoring, size_t aNumberOfLines); // legend bottom is below aNumberOfLines leaf lines
+    json panel_layout() const;
 };
 
 // ----------------------------------------------------------------------
@@ -1,25 +1,76 @@
+#include <sstream>
+
 #include "tree-import.hh"
 
 #include "read-file.hh"
 #include "newick.hh"
-#include "xz.hh"
+#include "compression.hh"
+
+// ----------------------------------------------------------------------
+
+  // Reads stdin, if data is compressed, decompression starts with the
+  // first chunk received and proceeds while the upstream process is still writing.
+static std::string read_stdin_decompressed()
+{
+    std::string buffer;
+    std::unique_ptr<Decompressor> decompressor;
+    bool format_detected = false;
+    read_from_file_descriptor(0, [&](const char* aData, size_t aSize) {
+            if (decompressor) {
+                decompressor->feed(aData, aSize);
+            }
+            else {
+                buffer.append(aData, aSize);
+                if (!format_detected && buffer.size() >= codec_magic_size()) {
+                    format_detected = true;
+                    auto const codec = codec_for_data(buffer);
+                    if (codec != nullptr) {
+                        decompressor = codec->decompressor();
+                        decompressor->feed(buffer.c_str(), buffer.size());
+                        buffer.clear();
+                    }
+                }
+            }
+        });
+    return decompressor ? decompressor->finish() : buffer;
+}
 
 // ----------------------------------------------------------------------
 
 void import_tree(Tree& tree, std::string buffer, TreeImage& aTreeImage)
 {
     if (buffer == "-")
-        buffer = read_stdin();
+        buffer = read_stdin_decompressed();
     else if (file_exists(buffer))
         buffer = read_file(buffer);
-    if (xz_compressed(buffer))
-        buffer = xz_decompress(buffer);
-    if (buffer[0] == '(')
-        parse_newick(tree, std::begin(buffer), std::end(buffer));
-    else if (buffer[0] == '{')
-        tree_from_json(tree, buffer, aTreeImage);
+    import_tree_from_data(tree, decompress_if_compressed(buffer), aTreeImage);
+}
+
+// ----------------------------------------------------------------------
+
+void import_tree_from_data(Tree& tree, std::string aData, TreeImage& aTreeImage)
+{
+    if (aData[0] == '(')
+        parse_newick(tree, std::begin(aData), std::end(aData));
+    else if (aData[0] == '{')
+        tree_from_json(tree, aData, aTreeImage);
     else
         throw std::runtime_error("cannot import tree: unrecognized source format");
 }
 
 // ----------------------------------------------------------------------
+
+std::vector<std::string> read_source_list(std::string aFilename)
+{
+    std::vector<std::string> sources;
+    std::istringstream list(read_file(aFilename));
+    for (std::string line; std::getline(list, line); ) {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        line.erase(0, line.find_first_not_of(" \t"));
+        if (!line.empty() && line[0] != '#')
+            sources.push_back(line);
+    }
+    return sources;
+}
+
+// ----------------------------------------------------------------------
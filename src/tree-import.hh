@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 // ----------------------------------------------------------------------
 
@@ -10,5 +11,10 @@ class TreeImage;
 // ----------------------------------------------------------------------
 
 void import_tree(Tree& tree, std::string buffer, TreeImage& aTreeImage);
+  // aData is newick or json source already read and decompressed
+void import_tree_from_data(Tree& tree, std::string aData, TreeImage& aTreeImage);
+
+  // Tree sources listed in aFilename one per line, empty lines and lines starting with # are ignored
+std::vector<std::string> read_source_list(std::string aFilename);
 
 // ----------------------------------------------------------------------
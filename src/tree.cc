@@ -5,6 +5,7 @@
 #include <cstdlib>
 #include <map>
 #include <list>
+#include <unordered_set>
 #include <algorithm>
 #include <fcntl.h>
 #include <unistd.h>
@@ -12,7 +13,7 @@
 
 #include "tree.hh"
 #include "tree-image.hh"
-#include "xz.hh"
+#include "compression.hh"
 
 // ----------------------------------------------------------------------
 
@@ -97,11 +98,22 @@ void Tree::analyse()
     auto set_line_no = [&current_line](Node& aNode) {
         aNode.line_no = current_line;
         ++current_line;
+        aNode.number_leaves = 1;
+        aNode.subtree_edge_length = 0.0;
+        aNode.first_line = aNode.last_line = aNode.line_no;
     };
-      // set top and bottom for each subtree node
+      // set top and bottom, leaf line range, number of leaves and max edge length to leaves for each subtree node
     auto set_top_bottom = [](Node& aNode) {
         aNode.top = aNode.subtree.begin()->middle();
         aNode.bottom = aNode.subtree.rbegin()->middle();
+        aNode.first_line = aNode.subtree.begin()->first_line;
+        aNode.last_line = aNode.subtree.rbegin()->last_line;
+        aNode.number_leaves = 0;
+        aNode.subtree_edge_length = 0.0;
+        for (const auto& node: aNode.subtree) {
+            aNode.number_leaves += node.number_leaves;
+            aNode.subtree_edge_length = std::max(aNode.subtree_edge_length, node.edge_length + node.subtree_edge_length);
+        }
     };
     iterate<Node&>(*this, set_line_no, &nope, set_top_bottom);
 
@@ -154,6 +166,71 @@ std::pair<const Node*, const Node*> Tree::top_bottom_nodes_of_subtree(std::strin
 
 // ----------------------------------------------------------------------
 
+static Node* find_branch(Node& aNode, std::string aBranchId)
+{
+    if (aNode.branch_id == aBranchId)
+        return &aNode;
+    for (auto& node: aNode.subtree) {
+        auto* found = find_branch(node, aBranchId);
+        if (found != nullptr)
+            return found;
+    }
+    return nullptr;
+
+} // find_branch
+
+void Tree::extract_subtree(std::string aBranchId)
+{
+    Node* root = aBranchId.empty() ? nullptr : find_branch(*this, aBranchId);
+    if (root == nullptr)
+        throw std::runtime_error("cannot extract subtree: branch_id not found: " + aBranchId);
+    if (root != this) {
+        const double root_edge_length = edge_length;
+        Node extracted = std::move(*root); // detach from the tree before the tree is overwritten
+        static_cast<Node&>(*this) = std::move(extracted);
+        edge_length = root_edge_length;
+    }
+
+} // Tree::extract_subtree
+
+// ----------------------------------------------------------------------
+
+  // Returns false if no leaves left in aNode
+static bool prune_node(Node& aNode, const std::unordered_set<std::string>& aNamesToKeep)
+{
+    if (aNode.is_leaf())
+        return aNamesToKeep.count(aNode.name) > 0;
+
+    size_t kept = 0;
+    for (size_t node_no = 0; node_no < aNode.subtree.size(); ++node_no) {
+        if (prune_node(aNode.subtree[node_no], aNamesToKeep)) {
+            if (kept != node_no)
+                aNode.subtree[kept] = std::move(aNode.subtree[node_no]);
+            ++kept;
+        }
+    }
+    aNode.subtree.erase(aNode.subtree.begin() + static_cast<long>(kept), aNode.subtree.end());
+    if (aNode.subtree.size() == 1) {
+        Node child = std::move(aNode.subtree.front());
+        child.edge_length += aNode.edge_length;
+        aNode = std::move(child);
+        return true;
+    }
+    return !aNode.subtree.empty();
+
+} // prune_node
+
+void Tree::prune(const std::vector<std::string>& aNamesToKeep)
+{
+    const double root_edge_length = edge_length;
+    if (!prune_node(*this, std::unordered_set<std::string>(aNamesToKeep.begin(), aNamesToKeep.end())))
+        throw std::runtime_error("cannot prune tree: none of the names to keep found");
+    edge_length = root_edge_length;
+
+} // Tree::prune
+
+// ----------------------------------------------------------------------
+
 void Tree::print(std::ostream& out) const
 {
     size_t indent = 0;
@@ -324,8 +401,9 @@ void tree_to_json(const Tree& aTree, std::string aFilename, std::string aCreator
         std::cout << output << std::endl;
     }
     else {
-        if (aFilename.substr(aFilename.size() - 3) == ".xz")
-            output = xz_compress(output);
+        auto const codec = codec_for_filename(aFilename);
+        if (codec != nullptr)
+            output = codec->compress(output);
         int fd = open(aFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
         if (fd < 0)
             throw std::runtime_error(std::string("cannot write ") + aFilename + ": " + std::strerror(errno));
@@ -13,10 +13,10 @@ class Node
  public:
     typedef std::vector<Node> Subtree;
 
-    inline Node() : edge_length(0), line_no(0), number_strains(1) {}
+    inline Node() : edge_length(0), line_no(0), number_strains(1), number_leaves(1), subtree_edge_length(0), first_line(0), last_line(0) {}
     inline Node(Node&&) = default;
       // inline Node(const Node& a) : edge_length(a.edge_length), name(a.name), date(a.date), line_no(a.line_no), subtree(a.subtree) { std::cout << "COPY " << (void*)&a << " --> " << (void*)this << ' ' << a.line_no << ' ' << line_no << std::endl; }
-    inline Node(std::string aName, double aEdgeLength, const Date& aDate = Date()) : edge_length(aEdgeLength), name(aName), date(aDate), line_no(0), number_strains(1) {}
+    inline Node(std::string aName, double aEdgeLength, const Date& aDate = Date()) : edge_length(aEdgeLength), name(aName), date(aDate), line_no(0), number_strains(1), number_leaves(1), subtree_edge_length(0), first_line(0), last_line(0) {}
     inline Node& operator=(Node&&) = default; // needed for swap needed for sort
 
     double edge_length;              // indent of node or subtree
@@ -36,6 +36,9 @@ class Node
     double top, bottom;         // subtree boundaries
     int number_strains;         // number of strains in subtree (generated by tre-seqdb --pos)
     std::string branch_id;      // generated by tre-seqdb
+    size_t number_leaves;       // number of leaves in subtree (set by Tree::analyse)
+    double subtree_edge_length; // max cumulative edge length from this node to its leaves (set by Tree::analyse)
+    size_t first_line, last_line; // line_no of the first and the last leaf of subtree (set by Tree::analyse)
 
       // for ladderizing
     double ladderize_max_edge_length;
@@ -81,6 +84,10 @@ class Tree : public Node
     std::pair<double, double> min_max_edge() const;
     std::pair<const Node*, const Node*> top_bottom_nodes_of_subtree(std::string branch_id) const;
 
+      // Both keep root edge length, nodes are moved, not copied, analyse() must be called afterwards
+    void extract_subtree(std::string aBranchId); // tree becomes the subtree with aBranchId
+    void prune(const std::vector<std::string>& aNamesToKeep); // removes other leaves, collapses unary nodes summing edge lengths
+
     inline void previously_updated(json aUpdated) { mPreviouslyUpdated = aUpdated; }
     inline json previously_updated() const { return mPreviouslyUpdated; }
 
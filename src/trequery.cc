@@ -0,0 +1,185 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "command-line-arguments.hh"
+
+#include "tree.hh"
+#include "tree-import.hh"
+#include "name-index.hh"
+#include "lca-index.hh"
+
+// ----------------------------------------------------------------------
+
+// fake TreeImage to avoid linking in real one
+class TreeImage
+{
+ public:
+    void load_from_json(const json&);
+    json dump_to_json() const;
+};
+
+void TreeImage::load_from_json(const json&) {}
+json TreeImage::dump_to_json() const { return json(); }
+
+static void query(std::istream& aInput, const NameIndex& aNameIndex, const LcaIndex& aLcaIndex);
+static void print_node(const Node* aNode, const NameIndex& aNameIndex);
+static void write_distances(std::istream& aInput, std::string aOutput, const NameIndex& aNameIndex, const LcaIndex& aLcaIndex, size_t aNumberOfThreads);
+
+// ----------------------------------------------------------------------
+
+int main(int argc, const char *argv[])
+{
+    using command_line_arguments::Help;
+    using command_line_arguments::Arg;
+    auto cl = command_line_arguments::make_command_line_arguments
+            (
+                Arg<bool>("ladderize", false, Help("Ladderize the tree before numbering lines (as tre2pdf --ladderize does)")),
+                Arg<std::string>("distances", std::string(), Help("Write patristic distances of all pairs of leaves found by queries in <queries.txt> to this file (tsv)")),
+                Arg<int>("jobs", 0, Help("Number of threads for --distances, 0 - all cores")),
+                Arg<command_line_arguments::PrintHelp>('h', "help", "Looks up leaves by name, queries are read from <queries.txt> (- for stdin) one per line:\n  name - exact match, prefix* - names starting with prefix, *text* - names containing text (case ignored)\n  tab separated queries - most recent common ancestor of the leaves found, patristic distance if two leaves found\nUsage: {progname} [options] <source.json> <queries.txt>", Help("print this help screen"))
+             );
+    cl->min_max(2, 2);                  // two arguments expected
+    try {
+        cl->parse(argc, argv);
+    }
+    catch (command_line_arguments::CommandLineError& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        cl->print_help(std::cerr);
+        return 1;
+    }
+
+    int exit_code = 0;
+    try {
+        Tree tre;
+        TreeImage tree_image;
+        import_tree(tre, cl->arg(0), tree_image);
+        if (cl->get<bool>("ladderize"))
+            tre.ladderize();
+        tre.analyse();
+        const NameIndex name_index(tre);
+        const LcaIndex lca_index(tre);
+
+        std::ifstream file;
+        if (cl->arg(1) != "-") {
+            file.open(cl->arg(1));
+            if (!file)
+                throw std::runtime_error("cannot read " + cl->arg(1));
+        }
+        std::istream& input = cl->arg(1) == "-" ? std::cin : file;
+        if (!cl->get<std::string>("distances").empty()) {
+            const int jobs = cl->get<int>("jobs");
+            write_distances(input, cl->get<std::string>("distances"), name_index, lca_index, jobs > 0 ? static_cast<size_t>(jobs) : std::max(1U, std::thread::hardware_concurrency()));
+        }
+        else {
+            query(input, name_index, lca_index);
+        }
+    }
+    catch (std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        exit_code = 1;
+    }
+    return exit_code;
+}
+
+// ----------------------------------------------------------------------
+
+  // Output for each query: "<query>: <number of matches>" followed by a
+  // line per matching leaf: name, line, date, clades and branch ids from
+  // the root down to the leaf. For tab separated queries most recent
+  // common ancestor of all the leaves found is reported.
+static void query(std::istream& aInput, const NameIndex& aNameIndex, const LcaIndex& aLcaIndex)
+{
+    for (std::string line; std::getline(aInput, line); ) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty())
+            continue;
+        std::vector<const Node*> leaves;
+        for (size_t start = 0; start <= line.size(); ) {
+            auto const end = std::min(line.find('\t', start), line.size());
+            if (end > start) {
+                const auto found = aNameIndex.find(line.substr(start, end - start));
+                leaves.insert(leaves.end(), found.begin(), found.end());
+            }
+            start = end + 1;
+        }
+        std::cout << line << ": " << leaves.size() << '\n';
+        for (const auto* leaf: leaves)
+            print_node(leaf, aNameIndex);
+        if (line.find('\t') != std::string::npos && !leaves.empty()) {
+            std::cout << "MRCA:";
+            print_node(aLcaIndex.mrca(leaves), aNameIndex);
+            if (leaves.size() == 2)
+                std::cout << "distance: " << aLcaIndex.distance(leaves[0], leaves[1]) << '\n';
+        }
+        std::cout << std::flush;
+    }
+
+} // query
+
+// ----------------------------------------------------------------------
+
+static void print_node(const Node* aNode, const NameIndex& aNameIndex)
+{
+    if (aNode->is_leaf())
+        std::cout << "  " << aNode->name << "  line: " << aNode->line_no;
+    else
+        std::cout << "  leaves: " << aNode->number_leaves << "  lines: " << aNode->first_line << ".." << aNode->last_line;
+    if (!aNode->date.empty())
+        std::cout << "  date: " << static_cast<std::string>(aNode->date);
+    if (!aNode->clades.empty()) {
+        std::cout << "  clades:";
+        for (const auto& clade: aNode->clades)
+            std::cout << ' ' << clade;
+    }
+    auto path = aNameIndex.root_path(aNode);
+    if (!aNode->branch_id.empty())
+        path.push_back(aNode->branch_id);
+    if (!path.empty()) {
+        std::cout << "  branch_id: " << path.back() << "  path:";
+        for (const auto& branch_id: path)
+            std::cout << ' ' << branch_id;
+    }
+    std::cout << '\n';
+
+} // print_node
+
+// ----------------------------------------------------------------------
+
+  // tsv: header with leaf names, then a row of distances per leaf
+static void write_distances(std::istream& aInput, std::string aOutput, const NameIndex& aNameIndex, const LcaIndex& aLcaIndex, size_t aNumberOfThreads)
+{
+    std::vector<const Node*> leaves;
+    for (std::string line; std::getline(aInput, line); ) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty()) {
+            const auto found = aNameIndex.find(line);
+            if (found.empty())
+                std::cerr << "WARNING: not found: " << line << std::endl;
+            leaves.insert(leaves.end(), found.begin(), found.end());
+        }
+    }
+    const auto distances = aLcaIndex.distances(leaves, aNumberOfThreads);
+
+    std::ofstream output(aOutput);
+    if (!output)
+        throw std::runtime_error("cannot write " + aOutput);
+    for (const auto* leaf: leaves)
+        output << '\t' << leaf->name;
+    output << '\n';
+    for (size_t row = 0; row < leaves.size(); ++row) {
+        output << leaves[row]->name;
+        for (size_t column = 0; column < leaves.size(); ++column)
+            output << '\t' << distances[row * leaves.size() + column];
+        output << '\n';
+    }
+    std::cout << "Distances of " << leaves.size() << " leaves written to " << aOutput << std::endl;
+
+} // write_distances
+
+// ----------------------------------------------------------------------
@@ -14,48 +14,90 @@
 
 // ----------------------------------------------------------------------
 
-const unsigned char sXzSig[] = { 0xFD, '7', 'z', 'X', 'Z', 0x00 };
 constexpr ssize_t sXzBufSize = 409600;
 
 // ----------------------------------------------------------------------
 
 bool xz_compressed(std::string input)
 {
-    return std::memcmp(input.c_str(), sXzSig, sizeof(sXzSig)) == 0;
+    return std::memcmp(input.c_str(), XZ_SIGNATURE, XZ_SIGNATURE_SIZE) == 0;
 }
 
 // ----------------------------------------------------------------------
 
 std::string xz_decompress(std::string buffer)
 {
-    lzma_stream strm = LZMA_STREAM_INIT; /* alloc and init lzma_stream struct */
-    if (lzma_stream_decoder(&strm, UINT64_MAX, LZMA_TELL_UNSUPPORTED_CHECK | LZMA_CONCATENATED) != LZMA_OK) {
+    XzDecompressor decompressor;
+    decompressor.feed(buffer.c_str(), buffer.size());
+    return decompressor.finish();
+
+} // xz_decompress
+
+// ----------------------------------------------------------------------
+
+struct XzDecompressor::Stream
+{
+    lzma_stream strm = LZMA_STREAM_INIT;
+};
+
+XzDecompressor::XzDecompressor()
+    : mStream(new Stream), mOutput(sXzBufSize, ' '), mOffset(0)
+{
+    if (lzma_stream_decoder(&mStream->strm, UINT64_MAX, LZMA_TELL_UNSUPPORTED_CHECK | LZMA_CONCATENATED) != LZMA_OK) {
         throw std::runtime_error("lzma decompression failed 1");
     }
+}
 
-    strm.next_in = reinterpret_cast<const uint8_t *>(buffer.c_str());
-    strm.avail_in = buffer.size();
-    std::string output(sXzBufSize, ' ');
-    ssize_t offset = 0;
+XzDecompressor::~XzDecompressor()
+{
+    lzma_end(&mStream->strm);
+}
+
+// ----------------------------------------------------------------------
+
+void XzDecompressor::feed(const char* aData, size_t aSize)
+{
+    code(aData, aSize, false);
+
+} // XzDecompressor::feed
+
+// ----------------------------------------------------------------------
+
+std::string XzDecompressor::finish()
+{
+    code(nullptr, 0, true);
+    mOutput.resize(mOffset);
+    return std::move(mOutput);
+
+} // XzDecompressor::finish
+
+// ----------------------------------------------------------------------
+
+  // returns true if end of stream reached
+bool XzDecompressor::code(const char* aData, size_t aSize, bool aFinish)
+{
+    lzma_stream& strm = mStream->strm;
+    strm.next_in = reinterpret_cast<const uint8_t *>(aData);
+    strm.avail_in = aSize;
     for (;;) {
-        strm.next_out = reinterpret_cast<uint8_t *>(&*(output.begin() + offset));
-        strm.avail_out = sXzBufSize;
-        auto const r = lzma_code(&strm, LZMA_FINISH);
+        if ((mOutput.size() - mOffset) < static_cast<size_t>(sXzBufSize))
+            mOutput.resize(mOutput.size() * 2); // geometric growth, input size is unknown when reading from a pipe
+        strm.next_out = reinterpret_cast<uint8_t *>(&*(mOutput.begin() + static_cast<ssize_t>(mOffset)));
+        strm.avail_out = mOutput.size() - mOffset;
+        auto const r = lzma_code(&strm, aFinish ? LZMA_FINISH : LZMA_RUN);
+        mOffset = mOutput.size() - strm.avail_out;
         if (r == LZMA_STREAM_END) {
-            output.resize(static_cast<size_t>(offset + sXzBufSize) - strm.avail_out);
-            break;
+            return true;
         }
-        else if (r == LZMA_OK) {
-            offset += sXzBufSize;
-            output.resize(static_cast<size_t>(offset + sXzBufSize));
-        }
-        else {
+        else if (r != LZMA_OK) {
             throw std::runtime_error("lzma decompression failed 2");
         }
+        else if (!aFinish && strm.avail_in == 0 && strm.avail_out > 0) {
+            return false;       // all available input consumed
+        }
     }
-    lzma_end(&strm);
-    return output;
-}
+
+} // XzDecompressor::code
 
 // ----------------------------------------------------------------------
 
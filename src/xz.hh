@@ -1,11 +1,38 @@
 #pragma once
 
 #include <string>
+#include <memory>
+
+#include "compression.hh"
 
 // ----------------------------------------------------------------------
 
+constexpr size_t XZ_SIGNATURE_SIZE = 6;
+constexpr char XZ_SIGNATURE[XZ_SIGNATURE_SIZE] = { '\xFD', '7', 'z', 'X', 'Z', '\x00' };
+
 bool xz_compressed(std::string input);
 std::string xz_compress(std::string input);
 std::string xz_decompress(std::string input);
 
 // ----------------------------------------------------------------------
+
+class XzDecompressor : public Decompressor
+{
+ public:
+    XzDecompressor();
+    virtual ~XzDecompressor();
+
+    virtual void feed(const char* aData, size_t aSize);
+    virtual std::string finish();
+
+ private:
+    struct Stream;
+    std::unique_ptr<Stream> mStream;
+    std::string mOutput;
+    size_t mOffset;
+
+    bool code(const char* aData, size_t aSize, bool aFinish);
+
+}; // class XzDecompressor
+
+// ----------------------------------------------------------------------
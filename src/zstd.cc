@@ -0,0 +1,99 @@
+#include "zstd.hh"
+
+#ifdef HAVE_ZSTD
+
+#include <stdexcept>
+
+#include <zstd.h>
+
+// ----------------------------------------------------------------------
+
+constexpr int sZstdLevel = 12; // much faster to decompress than xz -9e at slightly larger size
+
+// ----------------------------------------------------------------------
+
+std::string zstd_compress(std::string input)
+{
+    std::string output(ZSTD_compressBound(input.size()), ' ');
+    auto const size = ZSTD_compress(&*output.begin(), output.size(), input.c_str(), input.size(), sZstdLevel);
+    if (ZSTD_isError(size))
+        throw std::runtime_error(std::string("zstd compression failed: ") + ZSTD_getErrorName(size));
+    output.resize(size);
+    return output;
+
+} // zstd_compress
+
+// ----------------------------------------------------------------------
+
+std::string zstd_decompress(std::string input)
+{
+    ZstdDecompressor decompressor;
+    decompressor.feed(input.c_str(), input.size());
+    return decompressor.finish();
+
+} // zstd_decompress
+
+// ----------------------------------------------------------------------
+
+struct ZstdDecompressor::Stream
+{
+    ZSTD_DStream* strm = nullptr;
+    size_t last_result = 0;     // 0 when a frame is completely decoded
+};
+
+ZstdDecompressor::ZstdDecompressor()
+    : mStream(new Stream), mOutput(ZSTD_DStreamOutSize() * 4, ' '), mOffset(0)
+{
+    mStream->strm = ZSTD_createDStream();
+    if (mStream->strm == nullptr || ZSTD_isError(ZSTD_initDStream(mStream->strm)))
+        throw std::runtime_error("zstd decompression failed 1");
+}
+
+ZstdDecompressor::~ZstdDecompressor()
+{
+    ZSTD_freeDStream(mStream->strm);
+}
+
+// ----------------------------------------------------------------------
+
+void ZstdDecompressor::feed(const char* aData, size_t aSize)
+{
+    ZSTD_inBuffer in = { aData, aSize, 0 };
+    while (in.pos < in.size) {
+        if ((mOutput.size() - mOffset) < ZSTD_DStreamOutSize())
+            mOutput.resize(mOutput.size() * 2);
+        ZSTD_outBuffer out = { &*mOutput.begin(), mOutput.size(), mOffset };
+        mStream->last_result = ZSTD_decompressStream(mStream->strm, &out, &in);
+        if (ZSTD_isError(mStream->last_result))
+            throw std::runtime_error(std::string("zstd decompression failed 2: ") + ZSTD_getErrorName(mStream->last_result));
+        mOffset = out.pos;
+    }
+
+} // ZstdDecompressor::feed
+
+// ----------------------------------------------------------------------
+
+std::string ZstdDecompressor::finish()
+{
+      // flush data buffered inside the decoder
+    while (mStream->last_result != 0) {
+        if ((mOutput.size() - mOffset) < ZSTD_DStreamOutSize())
+            mOutput.resize(mOutput.size() * 2);
+        ZSTD_inBuffer in = { nullptr, 0, 0 };
+        ZSTD_outBuffer out = { &*mOutput.begin(), mOutput.size(), mOffset };
+        auto const prev_offset = mOffset;
+        mStream->last_result = ZSTD_decompressStream(mStream->strm, &out, &in);
+        if (ZSTD_isError(mStream->last_result))
+            throw std::runtime_error(std::string("zstd decompression failed 2: ") + ZSTD_getErrorName(mStream->last_result));
+        mOffset = out.pos;
+        if (mOffset == prev_offset && mStream->last_result != 0)
+            throw std::runtime_error("zstd decompression failed: unexpected end of input");
+    }
+    mOutput.resize(mOffset);
+    return std::move(mOutput);
+
+} // ZstdDecompressor::finish
+
+// ----------------------------------------------------------------------
+
+#endif
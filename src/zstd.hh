@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+#include "compression.hh"
+
+// ----------------------------------------------------------------------
+// zstd support is compiled in only if libzstd is found (see Makefile)
+
+#ifdef HAVE_ZSTD
+
+constexpr size_t ZSTD_SIGNATURE_SIZE = 4;
+constexpr char ZSTD_SIGNATURE[ZSTD_SIGNATURE_SIZE] = { '\x28', '\xB5', '\x2F', '\xFD' };
+
+std::string zstd_compress(std::string input);
+std::string zstd_decompress(std::string input);
+
+// ----------------------------------------------------------------------
+
+class ZstdDecompressor : public Decompressor
+{
+ public:
+    ZstdDecompressor();
+    virtual ~ZstdDecompressor();
+
+    virtual void feed(const char* aData, size_t aSize);
+    virtual std::string finish();
+
+ private:
+    struct Stream;
+    std::unique_ptr<Stream> mStream;
+    std::string mOutput;
+    size_t mOffset;
+
+}; // class ZstdDecompressor
+
+#endif
+
+// ----------------------------------------------------------------------